@@ -1,4 +1,5 @@
 #include <iostream>
+#include <atomic>
 #include <vector>
 #include <thread>
 #include <algorithm>
@@ -8,6 +9,8 @@
 #include "jobs/Scheduler.h"
 #include "jobs/JobGraph.h"
 #include "jobs/JobSpawner.h"
+#include "jobs/Parallel.h"
+#include "jobs/Task.h"
 #include "jobs/Statistics.h"
 
 uint32_t slow_hash(uint32_t x) {
@@ -19,63 +22,157 @@ uint32_t slow_hash(uint32_t x) {
     return x;
 }
 
-struct ParallelGenerateParams {
-    uint64_t* results;
-    uint32_t first;
+struct GenerateParams {
+    uint64_t* numbers;
     uint32_t amount;
 };
 
-void parallel_generate(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo& worker_info) {
-    const ParallelGenerateParams* params = static_cast<const ParallelGenerateParams*>(param_buffer);
+void generate(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo& worker_info) {
+    const GenerateParams* params = static_cast<const GenerateParams*>(param_buffer);
+    uint64_t* numbers = params->numbers;
+    jobs::parallel_for(job_spawner, worker_info, 0u, params->amount, [numbers](uint32_t i) { numbers[i] = slow_hash(i); });
+}
 
-    if (params->amount <= 1024) {
-        const jobs::UserJobLogger logger(worker_info);
-        const uint32_t end = params->first + params->amount;
-        for (uint32_t i = params->first; i != end; i++) {
-            params->results[i] = slow_hash(i);
-        }
-        return;
+struct SumParams {
+    const uint64_t* numbers;
+    jobs::Reduction<uint64_t>* sum;
+    uint32_t amount;
+};
+
+void sum(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo& worker_info) {
+    const SumParams* params = static_cast<const SumParams*>(param_buffer);
+    const uint64_t* numbers = params->numbers;
+    jobs::parallel_reduce(job_spawner, worker_info, 0u, params->amount, *params->sum, [numbers](uint32_t i) { return numbers[i]; });
+}
+
+// Used by the regression checks. The ones of cancellation only run with it enabled in Config.h.
+void cancel_run(const void*, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo&) {
+    if constexpr (jobs::cancellation) {
+        job_spawner.cancel_run();
     }
-    const uint32_t left_amount = params->amount / 2;
-    const ParallelGenerateParams left_params{ params->results, params->first, left_amount };
-    job_spawner.spawn(parallel_generate, left_params, true);
-    const ParallelGenerateParams right_params{ params->results, params->first + left_amount, params->amount - left_amount };
-    job_spawner.spawn(parallel_generate, right_params, true);
 }
 
-struct ParallelSumParams {
-    const uint64_t* numbers;
-    uint64_t* results;
-    uint32_t first_batch;
-    uint32_t batch_amount;
-    uint32_t batch_size;
+void count_run(const void* param_buffer, const jobs::JobSpawner&, jobs::WorkerInfo&) {
+    (*static_cast<std::atomic<uint32_t>* const*>(param_buffer))->fetch_add(1, std::memory_order::relaxed);
+}
+
+// A cancelled run has to complete even when a node has more successors than are released in one batch.
+bool check_cancelled_fan_out(jobs::Scheduler& scheduler) {
+    std::atomic<uint32_t> run_amount = 0;
+    std::atomic<uint32_t>* run_amount_pointer = &run_amount;
+    jobs::JobGraph graph;
+    jobs::JobGraphNode* root = graph.new_node(cancel_run, 0);
+    for (uint32_t i = 0; i != 4 * jobs::successor_release_batch_size; i++) {
+        graph.new_node(count_run, run_amount_pointer, { root });
+    }
+    scheduler.set_job_graph(&graph);
+    scheduler.run();
+    return run_amount.load() == 0;
+}
+
+// Counts the Task frames in existence: a copy lives in the frame of every Task it's passed to.
+std::atomic<int32_t> task_frame_amount = 0;
+
+struct TaskFrameCounter {
+    TaskFrameCounter() { task_frame_amount.fetch_add(1, std::memory_order::relaxed); }
+    TaskFrameCounter(const TaskFrameCounter&) { task_frame_amount.fetch_add(1, std::memory_order::relaxed); }
+    ~TaskFrameCounter() { task_frame_amount.fetch_sub(1, std::memory_order::relaxed); }
 };
 
-void parallel_sum(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo& worker_info) {
-    const ParallelSumParams* params = static_cast<const ParallelSumParams*>(param_buffer);
+jobs::Task<uint32_t> cancelled_leaf_task(TaskFrameCounter) {
+    const jobs::TaskContext context = co_await jobs::get_task_context();
+    co_return context.job_spawner.is_cancelled() ? 0 : 1;
+}
+
+jobs::Task<void> cancelled_parent_task(TaskFrameCounter) {
+    jobs::Task<uint32_t> first = cancelled_leaf_task(TaskFrameCounter());
+    jobs::Task<uint32_t> second = cancelled_leaf_task(TaskFrameCounter());
+    co_await jobs::when_all(first, second);
+}
+
+void cancel_run_with_task(const void*, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo& worker_info) {
+    cancel_run(nullptr, job_spawner, worker_info);
+    jobs::spawn_task(job_spawner, cancelled_parent_task(TaskFrameCounter()), true);
+}
 
-    if (params->batch_amount == 1) {
-        const jobs::UserJobLogger logger(worker_info);
-        const uint64_t* begin = params->numbers + params->first_batch * params->batch_size;
-        params->results[params->first_batch] = std::accumulate(begin, begin + params->batch_size, 0ull);
-        return;
+// Tasks of a cancelled run still return, so their frames are freed.
+bool check_cancelled_tasks(jobs::Scheduler& scheduler) {
+    jobs::JobGraph graph;
+    graph.new_node(cancel_run_with_task, 0);
+    scheduler.set_job_graph(&graph);
+    scheduler.run();
+    return task_frame_amount.load() == 0;
+}
+
+void cancel_run_with_created_node(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo& worker_info) {
+    cancel_run(nullptr, job_spawner, worker_info);
+    job_spawner.create_node(count_run, *static_cast<std::atomic<uint32_t>* const*>(param_buffer), false);
+}
+
+// Nodes created by Jobs have no JobGraphNode, but are skipped in a cancelled run all the same.
+bool check_cancelled_created_node(jobs::Scheduler& scheduler) {
+    std::atomic<uint32_t> run_amount = 0;
+    std::atomic<uint32_t>* run_amount_pointer = &run_amount;
+    jobs::JobGraph graph;
+    graph.new_node(cancel_run_with_created_node, run_amount_pointer);
+    scheduler.set_job_graph(&graph);
+    scheduler.run();
+    return run_amount.load() == 0;
+}
+
+void cancel_submitted_run(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo&) {
+    std::atomic<uint32_t>* run_amount = *static_cast<std::atomic<uint32_t>* const*>(param_buffer);
+    if constexpr (jobs::cancellation) {
+        if (!job_spawner.cancel_run()) {
+            job_spawner.spawn(count_run, run_amount, false);
+        }
+    }
+}
+
+// Submitted Jobs don't belong to a run that could be cancelled, so cancelling from one must not drop the Jobs submitted after it.
+bool check_cancelled_submitted_job(jobs::Scheduler& scheduler) {
+    std::atomic<uint32_t> run_amount = 0;
+    std::atomic<uint32_t>* run_amount_pointer = &run_amount;
+    std::atomic<uint32_t> node_run_amount = 0;
+    jobs::JobGraph graph;
+    graph.new_node(count_run, &node_run_amount);
+    scheduler.set_job_graph(&graph);
+    scheduler.submit(cancel_submitted_run, run_amount_pointer);
+    // Submitted Jobs are only taken while a run is in progress, and the workers don't go idle before they are completed.
+    for (uint32_t i = 0; i != 10000 && run_amount.load() == 0; i++) {
+        scheduler.run();
+    }
+    return run_amount.load() == 1;
+}
+
+// Skipping a node releases its successors, which must not recurse once per node of a long chain of skipped ones.
+bool check_disabled_chain(jobs::Scheduler& scheduler) {
+    std::atomic<uint32_t> run_amount = 0;
+    std::atomic<uint32_t>* run_amount_pointer = &run_amount;
+    jobs::JobGraph graph;
+    jobs::JobGraphNode* previous = nullptr;
+    for (uint32_t i = 0; i != 20000; i++) {
+        jobs::JobGraphNode* node = previous ? graph.new_node(count_run, run_amount_pointer, { previous }) : graph.new_node(count_run, run_amount_pointer);
+        node->set_enabled(false);
+        previous = node;
     }
-    const uint32_t left_amount = params->batch_amount / 2;
-    const ParallelSumParams left_params{ params->numbers, params->results, params->first_batch, left_amount, params->batch_size };
-    job_spawner.spawn(parallel_sum, left_params, true);
-    const ParallelSumParams right_params{ params->numbers, params->results, params->first_batch + left_amount, params->batch_amount - left_amount, params->batch_size };
-    job_spawner.spawn(parallel_sum, right_params, true);
+    graph.new_node(count_run, run_amount_pointer, { previous });
+    scheduler.set_job_graph(&graph);
+    scheduler.run();
+    return run_amount.load() == 1;
+}
+
+void report_check(const char* name, bool passed) {
+    std::cout << name << (passed ? ": Passed\n" : ": Failed!\n");
 }
 
 int main() {
     jobs::Scheduler scheduler(std::thread::hardware_concurrency(), 32);
     std::cout << "Running scheduler with " << scheduler.get_worker_amount() << " worker threads (including main thread).\n\n";
 
-    const uint32_t batch_amount = 1024;
-    const uint32_t batch_size = 1024;
-    const uint32_t number_amount = batch_amount * batch_size;
+    const uint32_t number_amount = 1024 * 1024;
     std::vector<uint64_t> numbers(number_amount);
-    std::vector<uint64_t> batch_results(batch_amount);
+    jobs::Reduction<uint64_t> sum_reduction(scheduler.get_worker_amount());
 
     std::cout << "***Scheduler benchmark***\n";
     std::cout << "Generating " << number_amount << " pseudorandom numbers using a quite expensive hash function,\nand calculating their sum.\n\n";
@@ -96,17 +193,13 @@ int main() {
 
     // Scheduler job graph setup
     // -------------------------
-    uint64_t scheduler_result = 0;
     jobs::JobGraph job_graph;
     // Node to generate numbers
-    const ParallelGenerateParams generate_params{ numbers.data(), 0u, number_amount };
-    jobs::JobGraphNode* generate_node = job_graph.new_node(parallel_generate, generate_params);
-    // Node to calculate batch sums, depends on generate_node
-    const ParallelSumParams batch_sum_params{ numbers.data(), batch_results.data(), 0u, batch_amount, batch_size };
-    jobs::JobGraphNode* batch_sum_node = job_graph.new_node(parallel_sum, batch_sum_params, { generate_node });
-    // Node to calculate sum of batch sums, depends on batch_sum_node
-    const ParallelSumParams result_sum_params{ batch_results.data(), &scheduler_result, 0u, 1u, batch_amount };
-    job_graph.new_node(parallel_sum, result_sum_params, { batch_sum_node });
+    const GenerateParams generate_params{ numbers.data(), number_amount };
+    jobs::JobGraphNode* generate_node = job_graph.new_node(generate, generate_params);
+    // Node to calculate the sum of numbers, depends on generate_node
+    const SumParams sum_params{ numbers.data(), &sum_reduction, number_amount };
+    job_graph.new_node(sum, sum_params, { generate_node });
     // Set the graph as current
     scheduler.set_job_graph(&job_graph);
 
@@ -114,6 +207,7 @@ int main() {
     // -------------
     const jobs::Timer scheduler_timer;
     scheduler.run();
+    const uint64_t scheduler_result = sum_reduction.collect();
     const std::chrono::duration<double, std::milli> scheduler_duration = scheduler_timer.get_elapsed();
     std::cout << "Scheduler run: " << scheduler_duration.count() << " ms\n";
 
@@ -128,6 +222,16 @@ int main() {
         std::cout << "Incorrect result!\n\n";
     }
 
+    std::cout << "***Regression checks***\n";
+    if constexpr (jobs::cancellation) {
+        report_check("Cancelled run with a wide fan-out", check_cancelled_fan_out(scheduler));
+        report_check("Cancelled run with Tasks", check_cancelled_tasks(scheduler));
+        report_check("Cancelled run with a created node", check_cancelled_created_node(scheduler));
+        report_check("Cancelling from a submitted Job", check_cancelled_submitted_job(scheduler));
+    }
+    report_check("Long chain of disabled nodes", check_disabled_chain(scheduler));
+    std::cout << "\n";
+
     std::cout << "\t***Details***\n";
     scheduler.write_statistics(std::cout);
 
@@ -0,0 +1,320 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+#include "../jobs/Scheduler.h"
+#include "../jobs/JobGraph.h"
+#include "../jobs/JobSpawner.h"
+#include "../jobs/JobQueue.h"
+#include "../jobs/JobAllocator.h"
+#include "../jobs/Parallel.h"
+#include "../jobs/Statistics.h"
+#include "../jobs/Task.h"
+
+// Microbenchmarks of the hot paths of the scheduler. Every benchmark is run a few times, and the fastest and median time per operation are
+// written to stdout as JSON, so that results from different revisions can be compared by a script. Progress is written to stderr.
+// Usage: Benchmarks [worker amount] [repetitions]
+
+struct Measurement {
+    uint64_t operation_amount;
+    std::chrono::nanoseconds duration;
+};
+
+struct Result {
+    std::string name;
+    uint32_t thread_amount;
+    uint64_t operation_amount;
+    double min_ns_per_operation;
+    double median_ns_per_operation;
+};
+
+template<typename Benchmark>
+Result measure(const std::string& name, uint32_t thread_amount, uint32_t repetitions, Benchmark benchmark) {
+    std::cerr << "Running " << name << " with " << thread_amount << " threads\n";
+    // Warm up caches and allocator pools first.
+    benchmark();
+    std::vector<double> ns_per_operation;
+    uint64_t operation_amount = 0;
+    for (uint32_t i = 0; i != repetitions; i++) {
+        const Measurement measurement = benchmark();
+        operation_amount = measurement.operation_amount;
+        ns_per_operation.push_back(static_cast<double>(measurement.duration.count()) / static_cast<double>(measurement.operation_amount));
+    }
+    std::sort(ns_per_operation.begin(), ns_per_operation.end());
+    return { name, thread_amount, operation_amount, ns_per_operation.front(), ns_per_operation[ns_per_operation.size() / 2] };
+}
+
+void write_results(std::ostream& out_stream, const std::vector<Result>& results) {
+    out_stream << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i != results.size(); i++) {
+        const Result& result = results[i];
+        out_stream << "    { \"name\": \"" << result.name << "\", \"threads\": " << result.thread_amount << ", \"operations\": " << result.operation_amount
+            << ", \"min_ns_per_operation\": " << result.min_ns_per_operation << ", \"median_ns_per_operation\": " << result.median_ns_per_operation << " }"
+            << (i + 1 != results.size() ? ",\n" : "\n");
+    }
+    out_stream << "  ]\n}\n";
+}
+
+// JobQueue and JobAllocator
+// -------------------------
+
+Measurement queue_push_pop(std::vector<jobs::Job>& job_pool) {
+    jobs::JobQueue queue;
+    const uint32_t round_amount = 1024;
+    const uint32_t batch_size = std::min<uint32_t>(static_cast<uint32_t>(job_pool.size()), static_cast<uint32_t>(jobs::queue_capacity));
+    const jobs::Timer timer;
+    for (uint32_t round = 0; round != round_amount; round++) {
+        for (uint32_t i = 0; i != batch_size; i++) {
+            queue.push(&job_pool[i]);
+        }
+        while (queue.pop()) {}
+    }
+    return { uint64_t(round_amount) * batch_size, timer.get_elapsed() };
+}
+
+// The owner pushes Jobs in batches and pops them, while thieves keep stealing. Every Job is taken exactly once, by either.
+Measurement queue_steal(std::vector<jobs::Job>& job_pool, uint32_t thief_amount) {
+    jobs::JobQueue queue;
+    const uint64_t total_amount = 1 << 20;
+    const uint32_t batch_size = std::min<uint32_t>(256, static_cast<uint32_t>(jobs::queue_capacity));
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> taken_amount = 0;
+    std::vector<std::thread> thieves;
+    const jobs::Timer timer;
+    for (uint32_t i = 0; i != thief_amount; i++) {
+        thieves.emplace_back([&]() {
+            uint64_t stolen_amount = 0;
+            while (!stop.load(std::memory_order::relaxed)) {
+                if (queue.steal()) {
+                    stolen_amount++;
+                }
+            }
+            taken_amount.fetch_add(stolen_amount);
+        });
+    }
+    uint64_t popped_amount = 0;
+    for (uint64_t pushed_amount = 0; pushed_amount < total_amount; pushed_amount += batch_size) {
+        for (uint32_t i = 0; i != batch_size; i++) {
+            queue.push(&job_pool[i]);
+        }
+        while (queue.pop()) {
+            popped_amount++;
+        }
+    }
+    stop.store(true);
+    for (std::thread& thief : thieves) {
+        thief.join();
+    }
+    const std::chrono::nanoseconds duration = timer.get_elapsed();
+    if (taken_amount.load() + popped_amount != total_amount) {
+        std::cerr << "queue_steal lost Jobs!\n";
+        std::exit(1);
+    }
+    return { total_amount, duration };
+}
+
+Measurement allocator_allocate() {
+    const uint32_t chunk_amount = 64;
+    jobs::JobChunkAllocator chunk_allocator(chunk_amount, chunk_amount);
+    jobs::JobAllocator allocator(chunk_allocator);
+    const uint64_t job_amount = uint64_t(chunk_amount) * jobs::JobChunk::job_amount;
+    const uint32_t round_amount = 16;
+    const jobs::Timer timer;
+    for (uint32_t round = 0; round != round_amount; round++) {
+        for (uint64_t i = 0; i != job_amount; i++) {
+            jobs::Job* job = allocator.allocate();
+            // Keep the allocation from being optimized away.
+            job->function = nullptr;
+        }
+        allocator.reset();
+        chunk_allocator.reset();
+    }
+    return { round_amount * job_amount, timer.get_elapsed() };
+}
+
+// Scheduler
+// ---------
+
+void empty_job(const void*, const jobs::JobSpawner&, jobs::WorkerInfo&) {}
+
+struct SpawnParams {
+    uint32_t amount;
+    bool use_spawn_n;
+};
+
+void spawn_empty_jobs(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo&) {
+    const SpawnParams* params = static_cast<const SpawnParams*>(param_buffer);
+    if (params->use_spawn_n) {
+        const uint32_t batch_size = 256;
+        static const SpawnParams batch_params[batch_size]{};
+        for (uint32_t i = 0; i < params->amount; i += batch_size) {
+            job_spawner.spawn_n(empty_job, batch_params, std::min(batch_size, params->amount - i), false);
+        }
+    }
+    else {
+        for (uint32_t i = 0; i != params->amount; i++) {
+            job_spawner.spawn(empty_job, *params, false);
+        }
+    }
+}
+
+struct TreeParams {
+    jobs::Reduction<uint64_t>* job_amount;
+    uint32_t depth;
+    bool unbalanced;
+};
+
+// With unbalanced == false, this is the call tree of recursive Fibonacci: fib(n) spawns fib(n - 1) and fib(n - 2).
+// With unbalanced == true, one child gets most of the remaining depth and the other very little.
+void tree(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo& worker_info) {
+    const TreeParams* params = static_cast<const TreeParams*>(param_buffer);
+    params->job_amount->add(worker_info.get_worker_index(), 1);
+    if (params->depth < 2) {
+        return;
+    }
+    const uint32_t small_depth = params->unbalanced ? params->depth / 8 : params->depth - 2;
+    job_spawner.spawn(tree, TreeParams{ params->job_amount, params->depth - 1, params->unbalanced }, job_spawner.has_node());
+    job_spawner.spawn(tree, TreeParams{ params->job_amount, small_depth, params->unbalanced }, job_spawner.has_node());
+}
+
+// The same call tree as tree() with unbalanced == false, as Tasks returning the amount of calls instead of counting them in a Reduction.
+jobs::Task<uint64_t> fib_task(uint32_t depth) {
+    if (depth < 2) {
+        co_return 1;
+    }
+    jobs::Task<uint64_t> first = fib_task(depth - 1);
+    jobs::Task<uint64_t> second = fib_task(depth - 2);
+    co_await jobs::when_all(first, second);
+    co_return first.get_result() + second.get_result() + 1;
+}
+
+struct FibTaskParams {
+    uint64_t* call_amount;
+    uint32_t depth;
+};
+
+jobs::Task<> fib_task_root(FibTaskParams params) {
+    *params.call_amount = co_await fib_task(params.depth);
+}
+
+void start_fib_task(const void* param_buffer, const jobs::JobSpawner& job_spawner, jobs::WorkerInfo&) {
+    jobs::spawn_task(job_spawner, fib_task_root(*static_cast<const FibTaskParams*>(param_buffer)), true);
+}
+
+template<typename Graph>
+Measurement run_graph(jobs::Scheduler& scheduler, const Graph& graph, uint32_t run_amount, uint64_t operations_per_run) {
+    scheduler.set_job_graph(&graph);
+    const jobs::Timer timer;
+    for (uint32_t i = 0; i != run_amount; i++) {
+        scheduler.run();
+    }
+    return { run_amount * operations_per_run, timer.get_elapsed() };
+}
+
+Measurement spawn_overhead(jobs::Scheduler& scheduler, bool use_spawn_n) {
+    const uint32_t job_amount = 100000;
+    jobs::JobGraph graph;
+    graph.new_node(spawn_empty_jobs, SpawnParams{ job_amount, use_spawn_n });
+    return run_graph(scheduler, graph, 10, job_amount);
+}
+
+Measurement tree_jobs(jobs::Scheduler& scheduler, uint32_t depth, bool unbalanced) {
+    jobs::Reduction<uint64_t> job_amount(scheduler.get_worker_amount());
+    jobs::JobGraph graph;
+    graph.new_node(tree, TreeParams{ &job_amount, depth, unbalanced });
+    scheduler.set_job_graph(&graph);
+    const jobs::Timer timer;
+    scheduler.run();
+    const std::chrono::nanoseconds duration = timer.get_elapsed();
+    return { job_amount.collect(), duration };
+}
+
+Measurement tree_tasks(jobs::Scheduler& scheduler, uint32_t depth) {
+    uint64_t call_amount = 0;
+    jobs::JobGraph graph;
+    graph.new_node(start_fib_task, FibTaskParams{ &call_amount, depth });
+    scheduler.set_job_graph(&graph);
+    const jobs::Timer timer;
+    scheduler.run();
+    const std::chrono::nanoseconds duration = timer.get_elapsed();
+    return { call_amount, duration };
+}
+
+Measurement chain(jobs::Scheduler& scheduler, bool compiled) {
+    const uint32_t node_amount = 1000;
+    jobs::JobGraph graph;
+    jobs::JobGraphNode* previous = graph.new_node(empty_job, 0);
+    for (uint32_t i = 1; i != node_amount; i++) {
+        previous = graph.new_node(empty_job, 0, { previous });
+    }
+    if (compiled) {
+        const jobs::CompiledJobGraph compiled_graph = graph.compile();
+        return run_graph(scheduler, compiled_graph, 10, node_amount);
+    }
+    return run_graph(scheduler, graph, 10, node_amount);
+}
+
+Measurement fan_out(jobs::Scheduler& scheduler, bool compiled) {
+    const uint32_t width = 1000;
+    jobs::JobGraph graph;
+    jobs::JobGraphNode* root = graph.new_node(empty_job, 0);
+    std::vector<jobs::JobGraphNode*> middle;
+    for (uint32_t i = 0; i != width; i++) {
+        middle.push_back(graph.new_node(empty_job, 0, { root }));
+    }
+    // The join node is chained to the middle nodes in groups, since predecessors are given as a fixed-size array.
+    jobs::JobGraphNode* join = nullptr;
+    for (uint32_t i = 0; i != width; i += 4) {
+        join = join ? graph.new_node(empty_job, 0, { join, middle[i], middle[i + 1], middle[i + 2], middle[i + 3] })
+            : graph.new_node(empty_job, 0, { middle[i], middle[i + 1], middle[i + 2], middle[i + 3] });
+    }
+    const uint64_t node_amount = 1 + width + width / 4;
+    if (compiled) {
+        const jobs::CompiledJobGraph compiled_graph = graph.compile();
+        return run_graph(scheduler, compiled_graph, 10, node_amount);
+    }
+    return run_graph(scheduler, graph, 10, node_amount);
+}
+
+Measurement run_latency(jobs::Scheduler& scheduler, uint32_t node_amount) {
+    jobs::JobGraph graph;
+    for (uint32_t i = 0; i != node_amount; i++) {
+        graph.new_node(empty_job, 0);
+    }
+    return run_graph(scheduler, graph, 1000, 1);
+}
+
+int main(int argc, char** argv) {
+    const uint32_t worker_amount = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : std::thread::hardware_concurrency();
+    const uint32_t repetitions = argc > 2 ? std::max(1, std::atoi(argv[2])) : 10;
+    std::vector<Result> results;
+
+    std::vector<jobs::Job> job_pool(jobs::queue_capacity);
+    results.push_back(measure("queue_push_pop", 1, repetitions, [&]() { return queue_push_pop(job_pool); }));
+    for (uint32_t thief_amount = 1; thief_amount < std::max(worker_amount, 2u); thief_amount *= 2) {
+        results.push_back(measure("queue_steal", thief_amount + 1, repetitions, [&]() { return queue_steal(job_pool, thief_amount); }));
+    }
+    results.push_back(measure("allocator_allocate", 1, repetitions, allocator_allocate));
+
+    jobs::Scheduler scheduler(worker_amount, 32);
+    const uint32_t thread_amount = scheduler.get_worker_amount();
+    results.push_back(measure("spawn_empty", thread_amount, repetitions, [&]() { return spawn_overhead(scheduler, false); }));
+    results.push_back(measure("spawn_n_empty", thread_amount, repetitions, [&]() { return spawn_overhead(scheduler, true); }));
+    results.push_back(measure("fib_25", thread_amount, repetitions, [&]() { return tree_jobs(scheduler, 25, false); }));
+    results.push_back(measure("fib_25_task", thread_amount, repetitions, [&]() { return tree_tasks(scheduler, 25); }));
+    results.push_back(measure("unbalanced_tree", thread_amount, repetitions, [&]() { return tree_jobs(scheduler, 1000, true); }));
+    results.push_back(measure("chain_1000", thread_amount, repetitions, [&]() { return chain(scheduler, false); }));
+    results.push_back(measure("chain_1000_compiled", thread_amount, repetitions, [&]() { return chain(scheduler, true); }));
+    results.push_back(measure("fan_out_1000", thread_amount, repetitions, [&]() { return fan_out(scheduler, false); }));
+    results.push_back(measure("fan_out_1000_compiled", thread_amount, repetitions, [&]() { return fan_out(scheduler, true); }));
+    results.push_back(measure("run_empty_graph", thread_amount, repetitions, [&]() { return run_latency(scheduler, 0); }));
+    results.push_back(measure("run_single_node", thread_amount, repetitions, [&]() { return run_latency(scheduler, 1); }));
+
+    write_results(std::cout, results);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace jobs {
+
+	// Reusable barrier for a group of threads, like std::barrier, except that the size of the group can be changed between phases.
+	class Barrier {
+	public:
+		using Size = uint32_t;
+		using AtomicSize = std::atomic<Size>;
+		static_assert(AtomicSize::is_always_lock_free, "Barrier will work without this, but may not be lock-free. It wants to be lock-free.");
+
+		Barrier(Size participant_amount) : participant_amount(participant_amount) {}
+		Barrier(const Barrier&) = delete;
+		Barrier(Barrier&&) = delete;
+		Barrier& operator=(const Barrier&) = delete;
+		Barrier& operator=(Barrier&&) = delete;
+		// May only be called while no thread is arriving at the barrier.
+		void set_participant_amount(Size amount) { participant_amount.store(amount, std::memory_order::relaxed); }
+		// Blocks until participant_amount threads have arrived in the current phase.
+		void arrive_and_wait();
+
+	private:
+		AtomicSize participant_amount;
+		AtomicSize arrived_amount = 0;
+		AtomicSize phase = 0;
+	};
+
+	inline void Barrier::arrive_and_wait() {
+		// The phase can't advance before this thread has arrived, so this is the phase being arrived at.
+		const Size current_phase = phase.load(std::memory_order::acquire);
+		if (arrived_amount.fetch_add(1, std::memory_order::acq_rel) + 1 == participant_amount.load(std::memory_order::relaxed)) {
+			// Reset before advancing, so that threads released by the new phase already arrive at the next one.
+			arrived_amount.store(0, std::memory_order::relaxed);
+			phase.store(current_phase + 1, std::memory_order::release);
+			phase.notify_all();
+			return;
+		}
+		phase.wait(current_phase, std::memory_order::acquire);
+	}
+
+}
\ No newline at end of file
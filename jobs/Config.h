@@ -5,14 +5,116 @@
 namespace jobs {
 
 	// Maximum number of Jobs queued in one JobQueue at any given moment. Power of 2 values provide slightly better performance due to JobQueue ring buffer implementation.
+	// With growable_queue, this is the initial capacity instead, and has to be a power of 2.
 	constexpr size_t queue_capacity = 4096;
 
+	// Maximum number of Jobs taken from another worker's JobQueue in one steal. Up to half of the Jobs in the queue are taken at once.
+	// The owner of a queue needs a CAS to pop any of the last max_steal_batch_size Jobs, so large values make popping from a nearly empty queue slower.
+	// 1 means stealing one Job at a time, as in the original Chase-Lev deque.
+	constexpr size_t max_steal_batch_size = 8;
+
+	// If true, a full JobQueue doubles its capacity instead of overflowing. The replaced buffers can still be read by stealing threads,
+	// so they are only freed at the end of Scheduler::run(). Fixed capacity is the default, since it gives more stable performance.
+	constexpr bool growable_queue = false;
+
+	// What to do with a Job that is pushed to a full JobQueue.
+	enum class QueueOverflowPolicy {
+		// Run the Job immediately on the pushing thread. Always succeeds, but the Job can't be stolen, and may recurse deeply on bursty spawns.
+		RunInline,
+		// Keep the Job in a list owned by the worker, and move it back to the JobQueue once the queue has room. Jobs in the list can't be stolen.
+		WorkerList,
+		// Push the Job to a queue shared by all workers, which is checked by stealing workers before other workers' queues.
+		// If the shared queue is full as well, the Job is run inline.
+		SharedQueue
+	};
+	constexpr QueueOverflowPolicy queue_overflow_policy = QueueOverflowPolicy::RunInline;
+
+	// Capacity of the SharedJobQueue used by QueueOverflowPolicy::SharedQueue. Has to be a power of 2.
+	constexpr size_t shared_queue_capacity = 4096;
+
+	// Maximum number of Jobs submitted with Scheduler::submit() that are waiting for a worker at any given moment. Has to be a power of 2.
+	constexpr size_t injection_queue_capacity = 1024;
+
+	// If true, the root Jobs of nodes on the critical path of a JobGraph (see JobGraph::update_critical_path()) are pushed to a small per-worker
+	// priority lane when their node is released. The lane is popped, and stolen from, before the JobQueue. Also times every node, for
+	// JobGraph::update_critical_path(true), which costs two clock reads per node, so it's disabled by default.
+	constexpr bool critical_path_priority = false;
+
+	// Capacity of the per-worker priority lane. When it's full, Jobs are pushed to the JobQueue instead. Has to be a power of 2.
+	constexpr size_t priority_lane_capacity = 64;
+
+	// Successors a completed node releases by itself. Longer successor lists are halved until they fit, with a free Job releasing each upper
+	// half, so that other workers can steal and split those in turn, and a wide layer of the graph is spread over the workers right away.
+	constexpr size_t successor_release_batch_size = 32;
+
+	// If true, the placement of nodes on workers is carried over from run to run, for graphs that are run every frame: A node is released to
+	// the worker that ran it in the previous run, and root nodes are spread over the workers by their durations in the previous run, longest
+	// first, each to the least loaded worker. Workers then start each run close to the balance they ended the previous one with, instead of
+	// finding it again by stealing. Placed Jobs go through a small per-worker queue that other workers can push to.
+	constexpr bool frame_coherent_placement = false;
+
+	// Capacity of the per-worker queue of Jobs placed by other workers, used with frame_coherent_placement. When it's full, Jobs are pushed to
+	// the releasing worker's own queue instead. Has to be a power of 2.
+	constexpr size_t placement_queue_capacity = 256;
+
+	// What a worker does after failing to steal, while not all workers are out of work.
+	enum class IdlePolicy {
+		// Yield the thread and try again. Lowest latency when work shows up, but keeps idle workers busy.
+		Yield,
+		// Pause for an exponentially growing amount of iterations between attempts, then block the worker until new work is pushed.
+		// Pushing a Job then costs a full fence, in order to check for blocked workers to wake up.
+		SpinThenPark
+	};
+	constexpr IdlePolicy idle_policy = IdlePolicy::SpinThenPark;
+
+	// With IdlePolicy::SpinThenPark, the number of failed steal attempts before blocking. The amount of pause instructions after each attempt
+	// doubles, starting from one, so the total spinning is about 2^idle_spin_step_amount pause instructions.
+	constexpr uint32_t idle_spin_step_amount = 10;
+
+	// Lets runs and nodes be cancelled (see JobSpawner::cancel_run()). Jobs of cancelled ones are dropped when a worker takes them from a queue,
+	// instead of being run. Costs a check of the run and the node before every Job, so it's off by default.
+	constexpr bool cancellation = false;
+
+	// Keeps track of the job counts and timings written by Scheduler::write_statistics(). Costs a clock read per job loop and per stolen Job, and two per
+	// UserJobLogger. When disabled, the statistics compile to nothing, apart from the worker index in WorkerInfo.
+	constexpr bool worker_statistics = true;
+
+	// Samples hardware and OS performance counters of every worker (see PerfCounters), reported by Scheduler::write_statistics() split between
+	// running own and stolen Jobs. Costs a system call at the start and end of every stretch of own Jobs and every stolen Job.
+	constexpr bool perf_counters = false;
+
+	// Measures, for every node in a run of a graph, when it became ready, started and was completed, and the total time spent running its Jobs.
+	// See JobGraph::write_timing_report(). Costs two clock reads per Job.
+	constexpr bool node_timing = false;
+
+	// Records job, steal and park events of every worker into a ring buffer, for Scheduler::write_trace(). Costs a clock read and a few stores
+	// per event. When disabled, recording compiles to nothing.
+	constexpr bool trace_events = false;
+
+	// Size in bytes of the blocks that nodes created while running (see JobSpawner::create_node()) are allocated from. Each run of a graph
+	// has its own blocks, which are kept for reuse by later runs.
+	constexpr size_t run_arena_block_size = 64 * 1024;
+
+	// Size in bytes of the blocks that each worker allocates scratch memory from (see JobSpawner::allocate_scratch()). The blocks are kept
+	// for reuse, so this only affects how often a worker allocates from the heap while warming up.
+	constexpr size_t scratch_block_size = 64 * 1024;
+
+	// Coroutine frames of Tasks up to this size in bytes are recycled through per-thread free lists (see TaskFrameAllocator), in size classes
+	// of task_frame_granularity bytes. Larger frames are allocated from the heap.
+	constexpr size_t max_pooled_task_frame_size = 1024;
+	constexpr size_t task_frame_granularity = 64;
+
 	// Number of Jobs in one inter-thread allocation. In other words, how many Jobs can be allocated thread-locally between each inter-thread allocation.
+	// Rounded so that the size of a chunk is a power of 2 bytes, with one Job's worth of it used by a header (see JobChunk).
 	constexpr size_t allocation_chunk_size = 2048;
 
 	// Minimum required size of Job::param_buffer. Actual size is calculated in Job.h to make the total size of Job a multiple of cacheline_size.
 	constexpr size_t min_param_buffer_size = 32;
 
+	// Number of iterations parallel_for() and parallel_reduce() run between checks for splitting their range. Ranges are split lazily, only when
+	// the worker's own JobQueue has run empty, so this mainly bounds the overhead of the check and the smallest piece of work that can be stolen.
+	constexpr size_t parallel_grain_size = 32;
+
 	// Used by JobQueue and in determining the size of Job, to prevent false sharing. Change the value according to target platform if needed.
 	constexpr size_t cacheline_size = std::hardware_destructive_interference_size;
 
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <memory>
+#include <cstring>
+#include <cassert>
+
+#include "Config.h"
+#include "Job.h"
+#include "SharedJobQueue.h"
+
+namespace jobs {
+
+	// Fixed-capacity queue of Jobs submitted by threads that are not workers, see Scheduler::submit(). Such threads have no JobAllocator,
+	// so the Jobs are kept in slots of the queue itself: A submitter takes a free slot, fills it in and passes it on to the workers, and the
+	// worker popping it copies the Job out and gives the slot back. Both hand-offs are SharedJobQueues, so any thread can push and pop.
+	class InjectionQueue {
+	public:
+		using Size = SharedJobQueue::Size;
+
+		// Capacity has to be a power of 2.
+		InjectionQueue(Size capacity);
+		InjectionQueue(const InjectionQueue&) = delete;
+		InjectionQueue(InjectionQueue&&) = delete;
+		InjectionQueue& operator=(const InjectionQueue&) = delete;
+		InjectionQueue& operator=(InjectionQueue&&) = delete;
+		// Returns false if the queue is full.
+		bool push(JobFunction* function, const void* params, size_t params_size, JobGraphNodeRun* node, JobGraphRun* graph_run);
+		// Copies the oldest submitted Job into job. Returns false if the queue is empty.
+		bool pop(Job& job);
+		// Only a hint, since other threads may push or pop at any moment.
+		bool is_empty() const { return submitted_slots.is_empty(); }
+
+	private:
+		std::unique_ptr<Job[]> slots;
+		SharedJobQueue free_slots;
+		SharedJobQueue submitted_slots;
+	};
+
+	inline InjectionQueue::InjectionQueue(Size capacity) : slots(new Job[capacity]), free_slots(capacity), submitted_slots(capacity) {
+		for (Size i = 0; i != capacity; i++) {
+			[[maybe_unused]] const bool pushed = free_slots.push(&slots[i]);
+			assert(pushed);
+		}
+	}
+
+	inline bool InjectionQueue::push(JobFunction* function, const void* params, size_t params_size, JobGraphNodeRun* node, JobGraphRun* graph_run) {
+		assert(function && params_size <= param_buffer_size);
+		Job* slot = free_slots.pop();
+		if (!slot) {
+			return false;
+		}
+		std::memcpy(slot->param_buffer, params, params_size);
+		slot->function = function;
+		slot->node = node;
+		slot->graph_run = graph_run;
+		// Both queues have room for every slot.
+		[[maybe_unused]] const bool pushed = submitted_slots.push(slot);
+		assert(pushed);
+		return true;
+	}
+
+	inline bool InjectionQueue::pop(Job& job) {
+		Job* slot = submitted_slots.pop();
+		if (!slot) {
+			return false;
+		}
+		std::memcpy(job.param_buffer, slot->param_buffer, param_buffer_size);
+		job.function = slot->function;
+		job.node = slot->node;
+		job.graph_run = slot->graph_run;
+		[[maybe_unused]] const bool pushed = free_slots.push(slot);
+		assert(pushed);
+		return true;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Job.h"
+
+namespace jobs {
+
+	// A file descriptor on Linux, a HANDLE opened with FILE_FLAG_OVERLAPPED on Windows.
+#if defined(_WIN32)
+	using FileHandle = void*;
+#else
+	using FileHandle = int;
+#endif
+
+	// A read in progress, see JobSpawner::spawn_after_read(). Once the read is done, the continuation Job is pushed to the workers
+	// like a Job submitted with Scheduler::submit(), but belonging to given node and run. Its params are a pointer to the request.
+	struct IoRequest {
+		// Only used on Windows, where it has to be the first member: Holds the OVERLAPPED of the read, which the completion is identified by.
+		alignas(void*) uint8_t overlapped[32];
+		FileHandle file;
+		void* buffer;
+		uint32_t size;
+		uint64_t offset;
+		// Bytes read, or a negative error code (-errno on Linux, -GetLastError() on Windows).
+		int64_t result;
+		JobFunction* continuation;
+		JobGraphNodeRun* node;
+		JobGraphRun* graph_run;
+		// Used by the thread doing blocking reads.
+		IoRequest* next;
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,311 @@
+#include "IoService.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+
+#include "Scheduler.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <cerrno>
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstring>
+#endif
+#endif
+
+namespace jobs {
+
+	namespace {
+
+#if defined(_WIN32)
+
+		static_assert(offsetof(IoRequest, overlapped) == 0 && sizeof(OVERLAPPED) <= sizeof(IoRequest::overlapped), "IoRequest::overlapped has to be able to hold an OVERLAPPED.");
+
+		int64_t get_read_result(BOOL succeeded, DWORD transferred_amount) {
+			if (succeeded) {
+				return transferred_amount;
+			}
+			const DWORD error = GetLastError();
+			// Reading at or past the end of the file is not an error, as with read().
+			return error == ERROR_HANDLE_EOF ? 0 : -static_cast<int64_t>(error);
+		}
+
+		int64_t read_blocking(IoRequest& request) {
+			OVERLAPPED& overlapped = *reinterpret_cast<OVERLAPPED*>(request.overlapped);
+			overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(request.offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(request.offset >> 32);
+			DWORD transferred_amount = 0;
+			if (!ReadFile(request.file, request.buffer, request.size, nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING) {
+				return get_read_result(FALSE, 0);
+			}
+			return get_read_result(GetOverlappedResult(request.file, &overlapped, &transferred_amount, TRUE), transferred_amount);
+		}
+
+#else
+
+		int64_t read_blocking(IoRequest& request) {
+			for (;;) {
+				const ssize_t result = pread(request.file, request.buffer, request.size, static_cast<off_t>(request.offset));
+				if (result >= 0) {
+					return result;
+				}
+				if (errno != EINTR) {
+					return -errno;
+				}
+			}
+		}
+
+#endif
+
+	}
+
+	IoService::IoService(Scheduler& scheduler, uint32_t queue_depth) : scheduler(scheduler) {
+		uses_os_queue = start_os(std::max(queue_depth, 1u));
+		if (uses_os_queue) {
+			thread = std::thread(&IoService::completion_loop_os, this);
+		}
+		else {
+			thread = std::thread(&IoService::blocking_loop, this);
+		}
+	}
+
+	IoService::~IoService() {
+		if (uses_os_queue) {
+			read_os(nullptr);
+			thread.join();
+			close_os();
+		}
+		else {
+			{
+				const std::lock_guard<std::mutex> lock(queue_mutex);
+				assert(!first_queued_request);
+				stopping = true;
+			}
+			queue_condition.notify_one();
+			thread.join();
+		}
+	}
+
+	void IoService::read(IoRequest& request) {
+		if (uses_os_queue) {
+			read_os(&request);
+			return;
+		}
+		request.next = nullptr;
+		{
+			const std::lock_guard<std::mutex> lock(queue_mutex);
+			if (last_queued_request) {
+				last_queued_request->next = &request;
+			}
+			else {
+				first_queued_request = &request;
+			}
+			last_queued_request = &request;
+		}
+		queue_condition.notify_one();
+	}
+
+	void IoService::blocking_loop() {
+		for (;;) {
+			IoRequest* request;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_condition.wait(lock, [this]() { return first_queued_request || stopping; });
+				if (!first_queued_request) {
+					return;
+				}
+				request = first_queued_request;
+				first_queued_request = request->next;
+				if (!first_queued_request) {
+					last_queued_request = nullptr;
+				}
+			}
+			request->result = read_blocking(*request);
+			complete(*request);
+		}
+	}
+
+	void IoService::complete(IoRequest& request) {
+		scheduler.io_completed(request);
+	}
+
+#if defined(_WIN32)
+
+	bool IoService::start_os(uint32_t queue_depth) {
+		// Completions are only dequeued by the completion thread, so the port needs no concurrency beyond one.
+		static_cast<void>(queue_depth);
+		completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+		return completion_port;
+	}
+
+	void IoService::read_os(IoRequest* request) {
+		if (!request) {
+			PostQueuedCompletionStatus(completion_port, 0, 0, nullptr);
+			return;
+		}
+		OVERLAPPED& overlapped = *reinterpret_cast<OVERLAPPED*>(request->overlapped);
+		overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(request->offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(request->offset >> 32);
+		// Fails harmlessly when the file has already been associated with the port by an earlier read.
+		CreateIoCompletionPort(request->file, completion_port, 0, 0);
+		if (!ReadFile(request->file, request->buffer, request->size, nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING) {
+			// Nothing will be posted to the port, so complete right away.
+			request->result = get_read_result(FALSE, 0);
+			complete(*request);
+		}
+	}
+
+	void IoService::completion_loop_os() {
+		for (;;) {
+			DWORD transferred_amount = 0;
+			ULONG_PTR key = 0;
+			OVERLAPPED* overlapped = nullptr;
+			const BOOL succeeded = GetQueuedCompletionStatus(completion_port, &transferred_amount, &key, &overlapped, INFINITE);
+			if (!overlapped) {
+				if (succeeded) {
+					// Posted by read_os(nullptr).
+					return;
+				}
+				continue;
+			}
+			IoRequest& request = *reinterpret_cast<IoRequest*>(overlapped);
+			request.result = get_read_result(succeeded, transferred_amount);
+			complete(request);
+		}
+	}
+
+	void IoService::close_os() {
+		CloseHandle(completion_port);
+	}
+
+#elif defined(__linux__)
+
+	bool IoService::start_os(uint32_t queue_depth) {
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		ring_descriptor = static_cast<int>(syscall(__NR_io_uring_setup, queue_depth, &params));
+		if (ring_descriptor < 0) {
+			ring_descriptor = -1;
+			return false;
+		}
+		submission_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+		completion_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		// With a single mapping, both rings are in the one mapped at the submission ring offset.
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			submission_ring_size = std::max(submission_ring_size, completion_ring_size);
+			completion_ring_size = 0;
+		}
+		submission_entries_size = params.sq_entries * sizeof(io_uring_sqe);
+		const auto map = [this](size_t size, off_t offset) {
+			void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_descriptor, offset);
+			return memory == MAP_FAILED ? nullptr : memory;
+		};
+		submission_ring = map(submission_ring_size, IORING_OFF_SQ_RING);
+		completion_ring = completion_ring_size ? map(completion_ring_size, IORING_OFF_CQ_RING) : submission_ring;
+		submission_entries = map(submission_entries_size, IORING_OFF_SQES);
+		if (!submission_ring || !completion_ring || !submission_entries) {
+			close_os();
+			return false;
+		}
+		uint8_t* submission_bytes = static_cast<uint8_t*>(submission_ring);
+		uint8_t* completion_bytes = static_cast<uint8_t*>(completion_ring);
+		submission_tail = reinterpret_cast<uint32_t*>(submission_bytes + params.sq_off.tail);
+		submission_mask = reinterpret_cast<uint32_t*>(submission_bytes + params.sq_off.ring_mask);
+		submission_array = reinterpret_cast<uint32_t*>(submission_bytes + params.sq_off.array);
+		completion_head = reinterpret_cast<uint32_t*>(completion_bytes + params.cq_off.head);
+		completion_tail = reinterpret_cast<uint32_t*>(completion_bytes + params.cq_off.tail);
+		completion_mask = reinterpret_cast<uint32_t*>(completion_bytes + params.cq_off.ring_mask);
+		completion_entries = completion_bytes + params.cq_off.cqes;
+		return true;
+	}
+
+	void IoService::read_os(IoRequest* request) {
+		const std::lock_guard<std::mutex> lock(submit_mutex);
+		// Every entry is submitted right away, so the ring is empty apart from the one being added.
+		const uint32_t tail = *submission_tail;
+		const uint32_t index = tail & *submission_mask;
+		io_uring_sqe& entry = static_cast<io_uring_sqe*>(submission_entries)[index];
+		std::memset(&entry, 0, sizeof(entry));
+		if (request) {
+			entry.opcode = IORING_OP_READ;
+			entry.fd = request->file;
+			entry.addr = reinterpret_cast<uintptr_t>(request->buffer);
+			entry.len = request->size;
+			entry.off = request->offset;
+			entry.user_data = reinterpret_cast<uintptr_t>(request);
+		}
+		else {
+			// Completed with null user_data, which stops the completion thread.
+			entry.opcode = IORING_OP_NOP;
+		}
+		submission_array[index] = index;
+		std::atomic_ref<uint32_t>(*submission_tail).store(tail + 1, std::memory_order::release);
+		while (syscall(__NR_io_uring_enter, ring_descriptor, 1, 0, 0, nullptr, 0) < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+			std::this_thread::yield();
+		}
+	}
+
+	void IoService::completion_loop_os() {
+		const io_uring_cqe* entries = static_cast<const io_uring_cqe*>(completion_entries);
+		for (;;) {
+			syscall(__NR_io_uring_enter, ring_descriptor, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			uint32_t head = std::atomic_ref<uint32_t>(*completion_head).load(std::memory_order::relaxed);
+			const uint32_t tail = std::atomic_ref<uint32_t>(*completion_tail).load(std::memory_order::acquire);
+			bool stop = false;
+			for (; head != tail; head++) {
+				const io_uring_cqe& entry = entries[head & *completion_mask];
+				if (!entry.user_data) {
+					stop = true;
+					continue;
+				}
+				IoRequest& request = *reinterpret_cast<IoRequest*>(static_cast<uintptr_t>(entry.user_data));
+				request.result = entry.res;
+				complete(request);
+			}
+			std::atomic_ref<uint32_t>(*completion_head).store(head, std::memory_order::release);
+			if (stop) {
+				return;
+			}
+		}
+	}
+
+	void IoService::close_os() {
+		if (submission_entries) {
+			munmap(submission_entries, submission_entries_size);
+		}
+		if (completion_ring && completion_ring != submission_ring) {
+			munmap(completion_ring, completion_ring_size);
+		}
+		if (submission_ring) {
+			munmap(submission_ring, submission_ring_size);
+		}
+		close(ring_descriptor);
+		ring_descriptor = -1;
+	}
+
+#else
+
+	bool IoService::start_os(uint32_t) {
+		return false;
+	}
+
+	void IoService::read_os(IoRequest*) {}
+
+	void IoService::completion_loop_os() {}
+
+	void IoService::close_os() {}
+
+#endif
+
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "IoRequest.h"
+
+namespace jobs {
+
+	class Scheduler;
+
+	// Performs reads without blocking the workers, on a thread of its own that waits for them to complete. Uses io_uring on Linux and an
+	// I/O completion port on Windows. Where these are not available (e.g. io_uring disabled by the kernel or a container), the thread does
+	// the reads itself, one at a time, which still keeps the workers free.
+	class IoService {
+	public:
+		// queue_depth is the amount of reads kept in flight by the kernel at once. More can be requested, they wait in the kernel's queues.
+		IoService(Scheduler& scheduler, uint32_t queue_depth);
+		IoService(const IoService&) = delete;
+		IoService(IoService&&) = delete;
+		IoService& operator=(const IoService&) = delete;
+		IoService& operator=(IoService&&) = delete;
+		// Stops the thread. No reads may be in flight.
+		~IoService();
+		// May be called from any thread. The request has to stay valid until it's completed.
+		void read(IoRequest& request);
+
+	private:
+		// Returns false if the OS queue is not available.
+		bool start_os(uint32_t queue_depth);
+		// Starts the read. With null, wakes up the completion thread to stop it.
+		void read_os(IoRequest* request);
+		void completion_loop_os();
+		// Releases the OS queue once the completion thread has stopped.
+		void close_os();
+		void blocking_loop();
+		void complete(IoRequest& request);
+
+		Scheduler& scheduler;
+		bool uses_os_queue = false;
+		// Only used on Linux: The io_uring file descriptor, the mapped rings and the parts of the rings used. The submission ring is only
+		// written while holding submit_mutex.
+		int ring_descriptor = -1;
+		void* submission_ring = nullptr;
+		size_t submission_ring_size = 0;
+		void* completion_ring = nullptr;
+		size_t completion_ring_size = 0;
+		void* submission_entries = nullptr;
+		size_t submission_entries_size = 0;
+		uint32_t* submission_tail = nullptr;
+		uint32_t* submission_mask = nullptr;
+		uint32_t* submission_array = nullptr;
+		uint32_t* completion_head = nullptr;
+		uint32_t* completion_tail = nullptr;
+		uint32_t* completion_mask = nullptr;
+		void* completion_entries = nullptr;
+		std::mutex submit_mutex;
+		// Only used on Windows.
+		void* completion_port = nullptr;
+		// Only used by the blocking fallback: Requests waiting to be read, oldest first.
+		std::mutex queue_mutex;
+		std::condition_variable queue_condition;
+		IoRequest* first_queued_request = nullptr;
+		IoRequest* last_queued_request = nullptr;
+		bool stopping = false;
+		std::thread thread;
+	};
+
+}
\ No newline at end of file
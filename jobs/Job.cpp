@@ -2,19 +2,74 @@
 
 #include <cassert>
 
-#include "JobAllocator.h"
-#include "JobQueue.h"
 #include "JobGraph.h"
+#include "JobGraphRun.h"
 #include "JobSpawner.h"
+#include "Task.h"
+#include "Worker.h"
 
 namespace jobs {
 
-	void Job::run(JobAllocator& allocator, JobQueue& queue, WorkerInfo& worker_info) const {
+	void Job::run(Worker& worker) const {
 		assert(function);
-		function(param_buffer, JobSpawner(allocator, queue, node), worker_info);
+		// Root Jobs are stored in the node states, every other Job comes from a JobAllocator.
+		const bool is_root_job = node && this == node->get_root_job();
+		if (is_root_job) {
+			node->root_job_started(worker);
+		}
+		if constexpr (trace_events) {
+			const JobGraphNode* graph_node = node ? node->get_node() : nullptr;
+			worker.trace.record(TraceEventType::JobBegin, graph_node ? graph_node->get_name() : nullptr, reinterpret_cast<const void*>(function),
+				graph_node ? graph_node->get_index() : TraceEvent::invalid_id);
+		}
+		if constexpr (node_timing) {
+			const Timer timer;
+			function(param_buffer, JobSpawner(worker, node, graph_run), worker.statistics.info);
+			if (node) {
+				node->add_job_time(timer.get_elapsed());
+			}
+		}
+		else {
+			function(param_buffer, JobSpawner(worker, node, graph_run), worker.statistics.info);
+		}
+		worker.trace.record(TraceEventType::JobEnd);
 		if (node) {
-			node->job_completed(queue);
+			node->job_completed(worker);
+		}
+		else {
+			graph_run->job_completed();
+		}
+		if (!is_root_job) {
+			worker.job_allocator.job_completed(this);
+		}
+	}
+
+	bool Job::is_cancelled() const {
+		if constexpr (cancellation) {
+			// Releasing successors is never dropped, since nothing else would complete them. In a cancelled run, they are skipped as they
+			// are released. Neither is resuming a Task, since only a Task that returns frees its frame and resumes the Task awaiting it.
+			if (function == JobGraphNodeRun::run_successor_release || function == resume_task) {
+				return false;
+			}
+			return node ? node->is_cancelled() : graph_run->is_cancelled();
+		}
+		return false;
+	}
+
+	void Job::drop(Worker& worker) const {
+		const bool is_root_job = node && this == node->get_root_job();
+		if (is_root_job) {
+			// Nothing of the node has run, so it's completed like a skipped node.
+			node->root_job_dropped(worker);
+			return;
+		}
+		if (node) {
+			node->job_completed(worker);
+		}
+		else {
+			graph_run->job_completed();
 		}
+		worker.job_allocator.job_completed(this);
 	}
 
 }
\ No newline at end of file
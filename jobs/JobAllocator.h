@@ -1,8 +1,13 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
+#include <new>
 #include <vector>
+#include <algorithm>
 #include <limits>
+#include <bit>
+#include <cstdint>
 #include <cassert>
 
 #include "Config.h"
@@ -10,12 +15,27 @@
 
 namespace jobs {
 
-	// Used internally by the allocators to make things simpler.
+	// Size and alignment of a JobChunk in bytes. A power of 2, so that the chunk of any Job can be found from the address of the Job.
+	constexpr size_t job_chunk_size = std::bit_ceil(allocation_chunk_size * sizeof(Job));
+
+	// Used internally by the allocators to make things simpler. The header takes the space of one Job.
 	struct JobChunk {
-		Job buffer[allocation_chunk_size];
+		using Size = uint32_t;
+		static constexpr Size job_amount = static_cast<Size>(job_chunk_size / sizeof(Job) - 1);
+
+		// Returns the chunk given Job was allocated from. Only valid for Jobs allocated by a JobAllocator.
+		static JobChunk* get(const Job* job) { return reinterpret_cast<JobChunk*>(reinterpret_cast<uintptr_t>(job) & ~(uintptr_t(job_chunk_size) - 1)); }
+
+		// Jobs of the chunk that have not been completed yet. Set to job_amount when the chunk is taken into use, so that it reaches zero
+		// only once every Job of the chunk has been allocated and completed.
+		alignas(cacheline_size) std::atomic<Size> unfinished_amount;
+		Job buffer[job_amount];
 	};
 
-	// Lock-free linear allocator of JobChunks. Used by a set of thread-local JobAllocators.
+	static_assert(sizeof(JobChunk) <= job_chunk_size, "The JobChunk header is expected to fit into the space of one Job.");
+
+	// Lock-free allocator of JobChunks. Used by a set of thread-local JobAllocators. Hands out the preallocated chunks first, then allocates more
+	// from the heap when needed, up to a maximum amount. Chunks are kept for reuse after reset().
 	class JobChunkAllocator {
 	public:
 		using Size = uint32_t;
@@ -23,33 +43,70 @@ namespace jobs {
 		static constexpr Size size_max = std::numeric_limits<Size>::max();
 		static_assert(AtomicSize::is_always_lock_free, "JobChunkAllocator will work without this, but may not be lock-free. It wants to be lock-free.");
 
-		JobChunkAllocator(Size chunk_amount) : chunks(chunk_amount) {}
+		JobChunkAllocator(Size chunk_amount, Size max_chunk_amount);
 		JobChunkAllocator(const JobChunkAllocator&) = delete;
 		JobChunkAllocator(JobChunkAllocator&&) = delete;
 		JobChunkAllocator& operator=(const JobChunkAllocator&) = delete;
 		JobChunkAllocator& operator=(JobChunkAllocator&&) = delete;
+		~JobChunkAllocator();
+		// Returns null when max_chunk_amount chunks are in use.
 		JobChunk* allocate();
 		void reset();
 
 	private:
-		std::vector<JobChunk> chunks;
+		static JobChunk* new_chunk();
+
+		const Size max_chunk_amount;
+		// Filled in on demand. Each slot is only written by the thread that got its index from next_index.
+		std::unique_ptr<std::atomic<JobChunk*>[]> chunks;
 		AtomicSize next_index = 0;
 	};
 
+	inline JobChunkAllocator::JobChunkAllocator(Size chunk_amount, Size max_chunk_amount)
+		: max_chunk_amount(std::max(chunk_amount, max_chunk_amount))
+		, chunks(new std::atomic<JobChunk*>[this->max_chunk_amount]) {
+		for (Size i = 0; i != this->max_chunk_amount; i++) {
+			chunks[i].store(i < chunk_amount ? new_chunk() : nullptr, std::memory_order::relaxed);
+		}
+	}
+
+	inline JobChunkAllocator::~JobChunkAllocator() {
+		for (Size i = 0; i != max_chunk_amount; i++) {
+			if (JobChunk* chunk = chunks[i].load(std::memory_order::relaxed)) {
+				chunk->~JobChunk();
+				::operator delete(chunk, std::align_val_t(job_chunk_size));
+			}
+		}
+	}
+
+	inline JobChunk* JobChunkAllocator::new_chunk() {
+		return new (::operator new(job_chunk_size, std::align_val_t(job_chunk_size))) JobChunk;
+	}
+
 	inline JobChunk* JobChunkAllocator::allocate() {
+		// Checked first, so that failing allocations don't keep increasing next_index.
+		if (next_index.load(std::memory_order::relaxed) >= max_chunk_amount) {
+			return nullptr;
+		}
 		const Size index = next_index.fetch_add(1, std::memory_order::relaxed);
 		assert(index < size_max);
-		if (index >= chunks.size()) {
+		if (index >= max_chunk_amount) {
 			return nullptr;
 		}
-		return chunks.data() + index;
+		JobChunk* chunk = chunks[index].load(std::memory_order::relaxed);
+		if (!chunk) {
+			chunk = new_chunk();
+			chunks[index].store(chunk, std::memory_order::relaxed);
+		}
+		return chunk;
 	}
 
 	inline void JobChunkAllocator::reset() {
 		next_index.store(0, std::memory_order::seq_cst);
 	}
 
-	// Linear allocator of Jobs. Each worker thread should have one, don't share between threads. When it runs out of Jobs, gets a new chunk from given JobChunkAllocator.
+	// Linear allocator of Jobs. Each worker thread should have one, don't share between threads. When it runs out of Jobs, takes a recycled chunk,
+	// or gets a new one from given JobChunkAllocator. A chunk is recycled by the worker completing its last Job, once every Job of it has been completed.
 	class JobAllocator {
 	public:
 		JobAllocator(JobChunkAllocator& chunk_allocator) : chunk_allocator(chunk_allocator) {}
@@ -58,31 +115,76 @@ namespace jobs {
 		JobAllocator& operator=(const JobAllocator&) = delete;
 		JobAllocator& operator=(JobAllocator&&) = delete;
 		Job* allocate();
+		// Allocates up to desired_amount contiguous Jobs. Fewer are allocated when the current chunk runs out, in which case the rest need to be
+		// allocated with another call. Returns null when out of chunks.
+		Job* allocate(uint32_t desired_amount, uint32_t& allocated_amount);
+		// Called after running a Job allocated by any JobAllocator. The Job must not be used afterwards.
+		void job_completed(const Job* job);
 		void reset();
 
 	private:
+		bool acquire_chunk();
+
 		JobChunk* chunk = nullptr;
 		uint32_t next_index = 0;
 		JobChunkAllocator& chunk_allocator;
+		// Chunks whose Jobs have all been completed.
+		std::vector<JobChunk*> free_chunks;
 	};
 
-	inline Job* JobAllocator::allocate() {
-		if (!chunk) {
+	inline bool JobAllocator::acquire_chunk() {
+		if (!free_chunks.empty()) {
+			chunk = free_chunks.back();
+			free_chunks.pop_back();
+		}
+		else {
 			chunk = chunk_allocator.allocate();
 			if (!chunk) {
-				return nullptr;
+				return false;
 			}
-			next_index = 0;
+		}
+		chunk->unfinished_amount.store(JobChunk::job_amount, std::memory_order::relaxed);
+		next_index = 0;
+		return true;
+	}
+
+	inline Job* JobAllocator::allocate() {
+		if (!chunk && !acquire_chunk()) {
+			return nullptr;
 		}
 		Job* job = chunk->buffer + next_index;
-		if (++next_index == allocation_chunk_size) {
+		if (++next_index == JobChunk::job_amount) {
 			chunk = nullptr;
 		}
 		return job;
 	}
 
+	inline Job* JobAllocator::allocate(uint32_t desired_amount, uint32_t& allocated_amount) {
+		assert(desired_amount > 0);
+		allocated_amount = 0;
+		if (!chunk && !acquire_chunk()) {
+			return nullptr;
+		}
+		Job* jobs = chunk->buffer + next_index;
+		allocated_amount = std::min<uint32_t>(desired_amount, JobChunk::job_amount - next_index);
+		next_index += allocated_amount;
+		if (next_index == JobChunk::job_amount) {
+			chunk = nullptr;
+		}
+		return jobs;
+	}
+
+	inline void JobAllocator::job_completed(const Job* job) {
+		JobChunk* job_chunk = JobChunk::get(job);
+		if (job_chunk->unfinished_amount.fetch_sub(1, std::memory_order::acq_rel) == 1) {
+			free_chunks.push_back(job_chunk);
+		}
+	}
+
 	inline void JobAllocator::reset() {
 		chunk = nullptr;
+		// Every chunk is handed out by JobChunkAllocator again.
+		free_chunks.clear();
 	}
 
 }
\ No newline at end of file
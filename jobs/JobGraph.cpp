@@ -1,45 +1,226 @@
 #include "JobGraph.h"
 
-#include "JobQueue.h"
+#include <algorithm>
+#include <string>
 
 namespace jobs {
 
-	void JobGraphNode::job_completed(JobQueue& queue) {
-		const Size old_unfinished_amount = unfinished_amount.fetch_sub(1, std::memory_order::seq_cst);
-		assert(old_unfinished_amount > 0);
-		if (old_unfinished_amount > 1) {
-			return;
+	template<typename Nodes>
+	void JobGraphNode::update_critical_path(const Nodes& nodes, bool use_last_durations) {
+		using std::chrono::nanoseconds;
+		const auto get_cost = [use_last_durations](const JobGraphNode& node) {
+			const nanoseconds last_duration = node.get_last_duration();
+			return use_last_durations && last_duration != nanoseconds::zero() ? last_duration : node.cost_hint;
+		};
+		// Longest path from the node to the end of the graph, computed in reverse topological order.
+		nanoseconds critical_path_length = nanoseconds::zero();
+		for (auto it = std::rbegin(nodes); it != std::rend(nodes); ++it) {
+			JobGraphNode& node = **it;
+			nanoseconds longest_successor_path = nanoseconds::zero();
+			for (const JobGraphNode* successor : node.successors) {
+				longest_successor_path = std::max(longest_successor_path, successor->critical_path_length);
+			}
+			node.critical_path_length = get_cost(node) + longest_successor_path;
+			critical_path_length = std::max(critical_path_length, node.critical_path_length);
+		}
+		// Longest path from any root node to the end of the node, computed in topological order. A node is on the critical path when the
+		// longest path through it is as long as the critical path itself.
+		std::vector<nanoseconds> path_lengths_to(std::size(nodes), nanoseconds::zero());
+		for (const auto& node_pointer : nodes) {
+			JobGraphNode& node = *node_pointer;
+			node.on_critical_path = path_lengths_to[node.index] + node.critical_path_length == critical_path_length;
+			const nanoseconds path_length_to = path_lengths_to[node.index] + get_cost(node);
+			for (const JobGraphNode* successor : node.successors) {
+				path_lengths_to[successor->index] = std::max(path_lengths_to[successor->index], path_length_to);
+			}
+		}
+	}
+
+	template<typename Nodes>
+	void JobGraphNode::write_timing_report(const Nodes& nodes, std::ostream& out_stream) {
+		using std::chrono::nanoseconds;
+		const auto to_us = [](nanoseconds duration) { return std::chrono::duration<double, std::micro>(duration).count(); };
+		const size_t node_amount = std::size(nodes);
+		nanoseconds run_duration = nanoseconds::zero();
+		nanoseconds total_job_time = nanoseconds::zero();
+		std::vector<std::vector<const JobGraphNode*>> predecessors(node_amount);
+		for (const auto& node : nodes) {
+			const JobGraphNodeTiming timing = node->get_last_timing();
+			run_duration = std::max(run_duration, timing.completion_time);
+			total_job_time += timing.job_time;
+			for (const JobGraphNode* successor : node->successors) {
+				predecessors[successor->index].push_back(&*node);
+			}
+		}
+		// Latest completion time of each node that would not have delayed its successors, computed in reverse topological order.
+		std::vector<nanoseconds> latest_completion_times(node_amount, run_duration);
+		for (auto it = std::rbegin(nodes); it != std::rend(nodes); ++it) {
+			const JobGraphNode& node = **it;
+			for (const JobGraphNode* successor : node.successors) {
+				const JobGraphNodeTiming timing = successor->get_last_timing();
+				latest_completion_times[node.index] = std::min(latest_completion_times[node.index], latest_completion_times[successor->index] - (timing.completion_time - timing.ready_time));
+			}
+		}
+		const auto get_label = [](const JobGraphNode& node) { return node.name ? std::string(node.name) : "Node " + std::to_string(node.index); };
+
+		const JobGraphNode* last_node = nullptr;
+		for (const auto& node_pointer : nodes) {
+			const JobGraphNode& node = *node_pointer;
+			const JobGraphNodeTiming timing = node.get_last_timing();
+			const nanoseconds slack = std::max(latest_completion_times[node.index] - timing.completion_time, nanoseconds::zero());
+			out_stream << get_label(node) << "\n";
+			out_stream << "\tReady at " << to_us(timing.ready_time) << " us, started " << to_us(timing.start_time - timing.ready_time) << " us later\n";
+			out_stream << "\tCompleted at " << to_us(timing.completion_time) << " us, " << to_us(timing.completion_time - timing.start_time) << " us after starting\n";
+			out_stream << "\tSpent " << to_us(timing.job_time) << " us running Jobs, slack " << to_us(slack) << " us\n";
+			if (!last_node || timing.completion_time > last_node->get_last_timing().completion_time) {
+				last_node = &node;
+			}
 		}
-		for (JobGraphNode* successor : successors) {
-			const Size old_predecessor_amount = successor->predecessor_amount.fetch_sub(1, std::memory_order::relaxed);
-			assert(old_predecessor_amount > 0);
-			if (old_predecessor_amount == 1) {
-				const bool pushed = queue.push(&successor->root_job);
-				assert(pushed);
+		// Walk back from the last node to be completed, always to the predecessor that was completed last, i.e. the one that released the node.
+		std::vector<const JobGraphNode*> critical_path;
+		for (const JobGraphNode* node = last_node; node;) {
+			critical_path.push_back(node);
+			const JobGraphNode* releasing_node = nullptr;
+			for (const JobGraphNode* predecessor : predecessors[node->index]) {
+				if (!releasing_node || predecessor->get_last_timing().completion_time > releasing_node->get_last_timing().completion_time) {
+					releasing_node = predecessor;
+				}
 			}
+			node = releasing_node;
+		}
+		out_stream << "Critical path:";
+		for (auto it = critical_path.rbegin(); it != critical_path.rend(); ++it) {
+			out_stream << (it == critical_path.rbegin() ? " " : " -> ") << get_label(**it);
+		}
+		out_stream << "\n";
+		out_stream << "Run took " << to_us(run_duration) << " us, with " << to_us(total_job_time) << " us of Jobs, ";
+		out_stream << "parallelism " << (run_duration != nanoseconds::zero() ? static_cast<double>(total_job_time.count()) / run_duration.count() : 0.0) << "\n";
+	}
+
+	void JobGraph::update_critical_path(bool use_last_durations) {
+		// Nodes are created after their predecessors, so the creation order is a topological order.
+		JobGraphNode::update_critical_path(nodes, use_last_durations);
+	}
+
+	void CompiledJobGraph::update_critical_path(bool use_last_durations) {
+		std::vector<JobGraphNode*> node_pointers(node_amount);
+		for (Size i = 0; i != node_amount; i++) {
+			node_pointers[i] = &nodes[i];
 		}
-		unfinished_amount.store(1, std::memory_order::relaxed);
-		predecessor_amount.store(initial_predecessor_amount, std::memory_order::relaxed);
+		JobGraphNode::update_critical_path(node_pointers, use_last_durations);
+	}
+
+	void JobGraph::write_timing_report(std::ostream& out_stream) const {
+		JobGraphNode::write_timing_report(nodes, out_stream);
 	}
 
-	void JobGraphNode::add_successor(JobGraphNode& successor) {
-		successors.push_back(&successor);
+	void CompiledJobGraph::write_timing_report(std::ostream& out_stream) const {
+		std::vector<const JobGraphNode*> node_pointers(node_amount);
+		for (Size i = 0; i != node_amount; i++) {
+			node_pointers[i] = &nodes[i];
+		}
+		JobGraphNode::write_timing_report(node_pointers, out_stream);
+	}
+
+	void JobGraph::add_predecessors(JobGraphNode& node, std::span<JobGraphNode* const> predecessors) {
+		// The ancestors of the node are its predecessors and their ancestors. Merging the sets makes every edge cost a pass over the bits
+		// of its predecessor instead of a search of the graph.
+		std::vector<uint64_t>& ancestor_set = ancestor_sets[node.index];
+		for (const JobGraphNode* predecessor : predecessors) {
+			assert(predecessor->owner == this);
+			const std::vector<uint64_t>& predecessor_set = ancestor_sets[predecessor->index];
+			for (size_t i = 0; i != predecessor_set.size(); i++) {
+				ancestor_set[i] |= predecessor_set[i];
+			}
+			ancestor_set[predecessor->index / 64] |= uint64_t(1) << (predecessor->index % 64);
+		}
+		for (JobGraphNode* predecessor : predecessors) {
+			bool redundant = false;
+			for (const JobGraphNode* descendant_candidate : predecessors) {
+				if (descendant_candidate != predecessor && is_ancestor(*predecessor, *descendant_candidate)) {
+					redundant = true;
+					break;
+				}
+			}
+			if (!redundant) {
+				add_successor(*predecessor, node);
+			}
+		}
+	}
+
+	bool JobGraph::is_ancestor(const JobGraphNode& ancestor, const JobGraphNode& descendant) const {
+		if (ancestor.index >= descendant.index) {
+			return false;
+		}
+		return ancestor_sets[descendant.index][ancestor.index / 64] >> (ancestor.index % 64) & 1;
+	}
+
+	void JobGraph::add_successor(JobGraphNode& predecessor, JobGraphNode& successor) {
+		std::vector<JobGraphNode*>& successor_list = successor_lists[predecessor.index];
+		successor_list.push_back(&successor);
+		predecessor.successors = successor_list;
 		successor.initial_predecessor_amount++;
-		successor.predecessor_amount.store(successor.initial_predecessor_amount, std::memory_order::relaxed);
 	}
 
-	bool JobGraphNode::is_ancestor_of(const JobGraphNode* descendant) const {
-		for (const JobGraphNode* successor : successors) {
-			if (successor == descendant) {
-				return true;
+	CompiledJobGraph JobGraph::compile() const {
+		using Size = JobGraphNode::Size;
+		const Size node_amount = static_cast<Size>(nodes.size());
+
+		// Sort topologically (Kahn's algorithm), starting from the root nodes in the order they were created.
+		std::vector<Size> order;
+		order.reserve(node_amount);
+		std::vector<Size> remaining_predecessor_amounts(node_amount);
+		for (Size i = 0; i != node_amount; i++) {
+			remaining_predecessor_amounts[i] = nodes[i]->initial_predecessor_amount;
+		}
+		for (const JobGraphNode* root_node : root_nodes) {
+			order.push_back(root_node->index);
+		}
+		size_t edge_amount = 0;
+		for (size_t i = 0; i != order.size(); i++) {
+			for (const JobGraphNode* successor : nodes[order[i]]->successors) {
+				edge_amount++;
+				if (--remaining_predecessor_amounts[successor->index] == 0) {
+					order.push_back(successor->index);
+				}
 			}
 		}
-		for (const JobGraphNode* successor : successors) {
-			if (successor->is_ancestor_of(descendant)) {
-				return true;
+		assert(order.size() == node_amount);
+
+		CompiledJobGraph graph;
+		graph.node_amount = node_amount;
+		graph.nodes.reset(new JobGraphNode[node_amount]);
+		graph.successors.reset(new JobGraphNode*[edge_amount]);
+		graph.source_node_positions.resize(node_amount);
+		for (Size position = 0; position != node_amount; position++) {
+			graph.source_node_positions[order[position]] = position;
+		}
+		JobGraphNode** successor_list = graph.successors.get();
+		for (Size position = 0; position != node_amount; position++) {
+			const JobGraphNode& source_node = *nodes[order[position]];
+			JobGraphNode& node = graph.nodes[position];
+			node.root_job = source_node.root_job;
+			node.initial_predecessor_amount = source_node.initial_predecessor_amount;
+			node.index = position;
+			node.cost_hint = source_node.cost_hint;
+			node.name = source_node.name;
+			node.enabled = source_node.enabled;
+			node.condition = source_node.condition;
+			node.set_last_duration(source_node.get_last_duration());
+			node.set_last_worker(source_node.get_last_worker());
+			node.set_last_timing(source_node.get_last_timing());
+			for (size_t i = 0; i != source_node.successors.size(); i++) {
+				successor_list[i] = &graph.nodes[graph.source_node_positions[source_node.successors[i]->index]];
 			}
+			node.successors = std::span<JobGraphNode* const>(successor_list, source_node.successors.size());
+			successor_list += source_node.successors.size();
+		}
+		graph.root_nodes.reserve(root_nodes.size());
+		for (Size position = 0; position != root_nodes.size(); position++) {
+			graph.root_nodes.push_back(&graph.nodes[position]);
 		}
-		return false;
+		graph.update_critical_path(true);
+		return graph;
 	}
 
 }
\ No newline at end of file
@@ -3,7 +3,11 @@
 #include <type_traits>
 #include <memory>
 #include <vector>
+#include <span>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
 #include <cstring>
 #include <cassert>
 
@@ -11,54 +15,135 @@
 
 namespace jobs {
 
-	class JobQueue;
 	class JobGraph;
+	class CompiledJobGraph;
+	class JobGraphRun;
+
+	// Decides whether a node is run, given the param buffer of its root Job. See JobGraphNode::set_condition().
+	using NodeCondition = bool(const void* param_buffer);
+
+	// Measured with node_timing in the previous run of a node. Points in time are relative to the start of the run.
+	struct JobGraphNodeTiming {
+		// When all predecessors were completed, or the run was started for root nodes.
+		std::chrono::nanoseconds ready_time = std::chrono::nanoseconds::zero();
+		// When the root Job started.
+		std::chrono::nanoseconds start_time = std::chrono::nanoseconds::zero();
+		// When the root Job and all sub-Jobs were completed.
+		std::chrono::nanoseconds completion_time = std::chrono::nanoseconds::zero();
+		// Total time spent running the root Job and sub-Jobs, summed over all workers.
+		std::chrono::nanoseconds job_time = std::chrono::nanoseconds::zero();
+	};
 
 	// Node in a JobGraph. Contains a single root Job that will be run when all nodes this depends on are completed.
 	// The root Job can then spawn sub-Jobs which need to be completed for the node to be considered completed.
+	// The node itself is not modified while running, apart from the results of its previous run (duration, worker and timing); the state of
+	// each run is kept in a JobGraphNodeRun. The results are written with relaxed atomic stores by every run of the node, so with overlapping
+	// runs of the same graph, they may come from any of those runs, and the fields of the timing from different ones.
 	class JobGraphNode {
 	public:
 		using Size = uint32_t;
-		using AtomicSize = std::atomic<Size>;
-		static_assert(AtomicSize::is_always_lock_free, "JobGraphNode will work without this, but may not be lock-free. It wants to be lock-free.");
 
 		JobGraphNode(const JobGraphNode&) = delete;
 		JobGraphNode(JobGraphNode&&) = delete;
 		JobGraphNode& operator=(const JobGraphNode&) = delete;
 		JobGraphNode& operator=(JobGraphNode&&) = delete;
-		// Called by JobSpawner when a new Job is spawned as a sub-Job.
-		void job_added();
-		// Called by Job after running its function.
-		void job_completed(JobQueue& queue);
+		// The Job copied for every run of the node.
 		const Job* get_root_job() const;
+		// Index of the node in its graph. In a CompiledJobGraph, nodes are indexed in topological order.
+		Size get_index() const { return index; }
+		// Expected time from the root Job starting to the node being completed. Used for finding the critical path of the graph.
+		// Defaults to 1 us, so that without hints the critical path is the longest chain of nodes.
+		void set_cost_hint(std::chrono::nanoseconds cost) { cost_hint = cost; }
+		std::chrono::nanoseconds get_cost_hint() const { return cost_hint; }
+		// Time from the root Job starting to the node being completed in the previous run. Zero if the node has not been run
+		// (or if critical_path_priority and frame_coherent_placement are disabled, as the time is not measured then).
+		std::chrono::nanoseconds get_last_duration() const { return std::chrono::nanoseconds(last_duration.load(std::memory_order::relaxed)); }
+		// Length of the longest path from this node to the end of the graph, including this node, as of the last critical path update.
+		std::chrono::nanoseconds get_critical_path_length() const { return critical_path_length; }
+		bool is_on_critical_path() const { return on_critical_path; }
+		// Index of the worker that ran the root Job in the previous run, used with frame_coherent_placement. no_worker if the node has not
+		// been run, or if frame_coherent_placement is disabled.
+		Size get_last_worker() const { return last_worker.load(std::memory_order::relaxed); }
+		static constexpr Size no_worker = ~Size(0);
+		// All zero if the node has not been run, or if node_timing is disabled.
+		JobGraphNodeTiming get_last_timing() const;
+		// Shown in traces (see Scheduler::write_trace()). The string is not copied.
+		void set_name(const char* new_name) { name = new_name; }
+		const char* get_name() const { return name; }
+		// A disabled node is skipped: when it's released, it's completed right away without running its root Job, releasing its successors
+		// in turn, so a disabled subtree costs next to nothing. Can be changed between runs, also on the nodes of a CompiledJobGraph; each run
+		// uses the value the node had when the run was started.
+		void set_enabled(bool new_enabled) { enabled = new_enabled; }
+		bool is_enabled() const { return enabled; }
+		// Called when the node is released, i.e. when the run is started for root nodes, and when the last predecessor is completed for others.
+		// If it returns false, the node is skipped like a disabled one. Runs on the releasing worker, so it should be cheap, e.g. reading a flag
+		// pointed to by the params. Null to always run the node.
+		void set_condition(NodeCondition* new_condition) { condition = new_condition; }
 
 	private:
 		friend class JobGraph;
+		friend class CompiledJobGraph;
+		friend class JobGraphNodeRun;
+		friend class JobGraphRun;
 
+		// Used by CompiledJobGraph, which copies the node data from a JobGraph.
+		JobGraphNode() = default;
 		template<typename Params>
-		JobGraphNode(JobFunction* root_job_function, const Params& params, const JobGraph* owner);
-		void add_successor(JobGraphNode& successor);
-		bool is_ancestor_of(const JobGraphNode* descendant) const;
+		JobGraphNode(JobFunction* root_job_function, const Params& params, Size index, const JobGraph* owner);
+		// Called by JobGraphNodeRun once the node is completed.
+		void set_last_duration(std::chrono::nanoseconds duration) { last_duration.store(duration.count(), std::memory_order::relaxed); }
+		void set_last_worker(Size worker_index) { last_worker.store(worker_index, std::memory_order::relaxed); }
+		void set_last_timing(const JobGraphNodeTiming& timing);
+		// Nodes need to be given in topological order.
+		template<typename Nodes>
+		static void update_critical_path(const Nodes& nodes, bool use_last_durations);
+		// Nodes need to be given in topological order.
+		template<typename Nodes>
+		static void write_timing_report(const Nodes& nodes, std::ostream& out_stream);
 
 		Job root_job;
 		Size initial_predecessor_amount = 0;
-		AtomicSize predecessor_amount = 0;
-		AtomicSize unfinished_amount = 1;
-		std::vector<JobGraphNode*> successors;
-		const JobGraph* owner;
+		Size index = 0;
+		// Points to a list owned by the graph.
+		std::span<JobGraphNode* const> successors;
+		bool on_critical_path = false;
+		bool enabled = true;
+		NodeCondition* condition = nullptr;
+		const char* name = nullptr;
+		// Null in a CompiledJobGraph.
+		const JobGraph* owner = nullptr;
+		std::chrono::nanoseconds cost_hint = std::chrono::microseconds(1);
+		std::chrono::nanoseconds critical_path_length = std::chrono::nanoseconds::zero();
+		// The results of the previous run, durations and times in nanoseconds.
+		std::atomic<int64_t> last_duration = 0;
+		std::atomic<Size> last_worker = no_worker;
+		std::atomic<int64_t> last_ready_time = 0;
+		std::atomic<int64_t> last_start_time = 0;
+		std::atomic<int64_t> last_completion_time = 0;
+		std::atomic<int64_t> last_job_time = 0;
 	};
 
+	inline JobGraphNodeTiming JobGraphNode::get_last_timing() const {
+		using std::chrono::nanoseconds;
+		return { nanoseconds(last_ready_time.load(std::memory_order::relaxed)), nanoseconds(last_start_time.load(std::memory_order::relaxed)),
+			nanoseconds(last_completion_time.load(std::memory_order::relaxed)), nanoseconds(last_job_time.load(std::memory_order::relaxed)) };
+	}
+
+	inline void JobGraphNode::set_last_timing(const JobGraphNodeTiming& timing) {
+		last_ready_time.store(timing.ready_time.count(), std::memory_order::relaxed);
+		last_start_time.store(timing.start_time.count(), std::memory_order::relaxed);
+		last_completion_time.store(timing.completion_time.count(), std::memory_order::relaxed);
+		last_job_time.store(timing.job_time.count(), std::memory_order::relaxed);
+	}
+
 	template<typename Params>
-	inline JobGraphNode::JobGraphNode(JobFunction* root_job_function, const Params& params, const JobGraph* owner) : owner(owner) {
+	inline JobGraphNode::JobGraphNode(JobFunction* root_job_function, const Params& params, Size index, const JobGraph* owner) : index(index), owner(owner) {
 		static_assert(sizeof(Params) <= param_buffer_size, "Params has to fit into Job::param_buffer. Data that does not fit needs to be allocated elsewhere and pointed to in Params.");
-		static_assert(std::is_trivial_v<Params>, "Params has to be a trivial type. The data is memcpy'd into Job::param_buffer.");
+		static_assert(std::is_trivially_copyable_v<Params>, "Params has to be a trivially copyable type. The data is memcpy'd into Job::param_buffer.");
 		std::memcpy(root_job.param_buffer, &params, sizeof(Params));
 		root_job.function = root_job_function;
-		root_job.node = this;
-	}
-
-	inline void JobGraphNode::job_added() {
-		unfinished_amount.fetch_add(1, std::memory_order::relaxed);
+		root_job.node = nullptr;
+		root_job.graph_run = nullptr;
 	}
 
 	inline const Job* JobGraphNode::get_root_job() const {
@@ -66,8 +151,8 @@ namespace jobs {
 	}
 
 	// Dependency graph for Jobs. Not generally meant to be modified while it is being run; dynamic dispatch can instead be achieved by
-	// having a Job function spawn sub-Jobs into its own node based on some state (external to the job system).
-	// It would be possible to modify the graph on the fly, but would need to make sure dependencies are not broken.
+	// having a Job function spawn sub-Jobs into its own node based on some state (external to the job system), or by creating new nodes
+	// into the current run with JobSpawner::create_node(). Such nodes only exist for the duration of the run, and leave the graph unmodified.
 	class JobGraph {
 	public:
 		// Creates a node with no prior dependencies. The root jobs of all such nodes will begin executing when the Scheduler runs this graph.
@@ -79,39 +164,87 @@ namespace jobs {
 		// Creates a node that depends on given predecessor nodes. All predecessors are passed at once to enforce an acyclic graph, meaning no circular dependencies.
 		template<typename Params, size_t N>
 		JobGraphNode* new_node(JobFunction* root_job_function, const Params& params, JobGraphNode* (&&predecessors)[N]);
-		// Called by Scheduler in order to start running the graph. Returns a pointer to the root job of a root node, null if indexing out of bounds.
+		// Returns a pointer to the root job of a root node, null if indexing out of bounds.
 		const Job* get_root_job(uint32_t index) const;
+		// Used in order to start running the graph.
+		std::span<JobGraphNode* const> get_root_nodes() const { return root_nodes; }
+		// Finds the critical path of the graph, i.e. the nodes on the longest path from any root node to the end of the graph, weighing each node
+		// by its cost hint, or by its duration in the previous run if use_last_durations is true and the node has been run. With critical_path_priority,
+		// nodes on the critical path are run first when they are released. Call after building the graph, or between runs to use fresh timings.
+		void update_critical_path(bool use_last_durations = false);
+		// Writes the timing of every node in the previous run, measured with node_timing, followed by the critical path the run actually took, and the
+		// parallelism of the run (total Job time divided by the length of the run). The slack of a node is how much later it could have been completed
+		// without delaying the end of the run, given the measured durations of the nodes after it. Should not be called while the graph is being run.
+		void write_timing_report(std::ostream& out_stream) const;
+		// Creates an immutable copy of the graph with a more cache-friendly memory layout, and with an updated critical path. See CompiledJobGraph.
+		CompiledJobGraph compile() const;
 
 	private:
+		friend class JobGraphRun;
+
+		JobGraphNode* create_node(JobGraphNode* node);
+		// Makes node depend on given predecessors, leaving out the ones that are already ancestors of another predecessor.
+		void add_predecessors(JobGraphNode& node, std::span<JobGraphNode* const> predecessors);
+		void add_successor(JobGraphNode& predecessor, JobGraphNode& successor);
+		bool is_ancestor(const JobGraphNode& ancestor, const JobGraphNode& descendant) const;
+
 		std::vector<std::unique_ptr<JobGraphNode>> nodes;
+		// Indexed like nodes. Each node's successors span points to its list.
+		std::vector<std::vector<JobGraphNode*>> successor_lists;
+		// Indexed like nodes. Bit i of a node's set tells whether node i is an ancestor of it. Nodes are created after their predecessors,
+		// so a node's ancestors all have smaller indices, and its set only needs that many bits.
+		std::vector<std::vector<uint64_t>> ancestor_sets;
+		std::vector<JobGraphNode*> root_nodes;
+	};
+
+	// Immutable version of a JobGraph, with all nodes in one contiguous array in topological order, and all successor lists in another
+	// (in compressed sparse row form), instead of each node and list being allocated separately. Root nodes come first in the array.
+	// Can be run by the Scheduler like a JobGraph.
+	class CompiledJobGraph {
+	public:
+		using Size = JobGraphNode::Size;
+
+		CompiledJobGraph(const CompiledJobGraph&) = delete;
+		CompiledJobGraph(CompiledJobGraph&&) = default;
+		CompiledJobGraph& operator=(const CompiledJobGraph&) = delete;
+		CompiledJobGraph& operator=(CompiledJobGraph&&) = default;
+		// Returns a pointer to the root job of a root node, null if indexing out of bounds.
+		const Job* get_root_job(uint32_t index) const;
+		// Used in order to start running the graph.
+		std::span<JobGraphNode* const> get_root_nodes() const { return root_nodes; }
+		Size get_node_amount() const { return node_amount; }
+		// Returns the compiled counterpart of a node in the JobGraph this graph was compiled from.
+		JobGraphNode* get_node(const JobGraphNode* source_node) const;
+		// See JobGraph::update_critical_path(). Only the per-node scheduling data is modified, not the graph structure.
+		void update_critical_path(bool use_last_durations = false);
+		// See JobGraph::write_timing_report().
+		void write_timing_report(std::ostream& out_stream) const;
+
+	private:
+		friend class JobGraph;
+		friend class JobGraphRun;
+
+		CompiledJobGraph() = default;
+
+		Size node_amount = 0;
+		std::unique_ptr<JobGraphNode[]> nodes;
+		std::unique_ptr<JobGraphNode*[]> successors;
 		std::vector<JobGraphNode*> root_nodes;
+		// Indexed by source node index.
+		std::vector<Size> source_node_positions;
 	};
 
 	template<typename Params>
 	inline JobGraphNode* JobGraph::new_node(JobFunction* root_job_function, const Params& params) {
-		nodes.push_back(std::unique_ptr<JobGraphNode>(new JobGraphNode(root_job_function, params, this)));
-		JobGraphNode* node = nodes.back().get();
+		JobGraphNode* node = create_node(new JobGraphNode(root_job_function, params, static_cast<JobGraphNode::Size>(nodes.size()), this));
 		root_nodes.push_back(node);
 		return node;
 	}
 
 	template<typename Params, size_t N>
 	inline JobGraphNode* JobGraph::new_node(JobFunction* root_job_function, const Params& params, JobGraphNode* (&predecessors)[N]) {
-		nodes.push_back(std::unique_ptr<JobGraphNode>(new JobGraphNode(root_job_function, params, this)));
-		JobGraphNode* node = nodes.back().get();
-		for (JobGraphNode* predecessor : predecessors) {
-			assert(predecessor->owner == this);
-			bool redundant = false;
-			for (const JobGraphNode* descendant_candidate : predecessors) {
-				if (descendant_candidate != predecessor && predecessor->is_ancestor_of(descendant_candidate)) {
-					redundant = true;
-					break;
-				}
-			}
-			if (!redundant) {
-				predecessor->add_successor(*node);
-			}
-		}
+		JobGraphNode* node = create_node(new JobGraphNode(root_job_function, params, static_cast<JobGraphNode::Size>(nodes.size()), this));
+		add_predecessors(*node, predecessors);
 		return node;
 	}
 
@@ -127,4 +260,23 @@ namespace jobs {
 		return root_nodes[index]->get_root_job();
 	}
 
+	inline JobGraphNode* JobGraph::create_node(JobGraphNode* node) {
+		nodes.push_back(std::unique_ptr<JobGraphNode>(node));
+		successor_lists.emplace_back();
+		ancestor_sets.emplace_back((node->index + 63) / 64, 0);
+		return node;
+	}
+
+	inline const Job* CompiledJobGraph::get_root_job(uint32_t index) const {
+		if (index >= root_nodes.size()) {
+			return nullptr;
+		}
+		return root_nodes[index]->get_root_job();
+	}
+
+	inline JobGraphNode* CompiledJobGraph::get_node(const JobGraphNode* source_node) const {
+		assert(source_node && source_node->index < source_node_positions.size());
+		return &nodes[source_node_positions[source_node->index]];
+	}
+
 }
\ No newline at end of file
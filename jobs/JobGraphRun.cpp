@@ -0,0 +1,254 @@
+#include "JobGraphRun.h"
+
+#include <type_traits>
+#include <cstring>
+#include <cassert>
+
+#include "JobGraph.h"
+#include "JobSpawner.h"
+#include "Scheduler.h"
+#include "Worker.h"
+
+namespace jobs {
+
+	void JobGraphNodeRun::job_completed(Worker& worker) {
+		const Size old_unfinished_amount = unfinished_amount.fetch_sub(1, std::memory_order::seq_cst);
+		assert(old_unfinished_amount > 0);
+		if (old_unfinished_amount > 1) {
+			return;
+		}
+		if (node) {
+			if constexpr (critical_path_priority || node_timing || frame_coherent_placement) {
+				const std::chrono::steady_clock::time_point completion_time = std::chrono::steady_clock::now();
+				if constexpr (critical_path_priority || frame_coherent_placement) {
+					node->set_last_duration(completion_time - start_time);
+				}
+				if constexpr (node_timing) {
+					const std::chrono::steady_clock::time_point run_start_time = graph_run->start_time;
+					node->set_last_timing({ ready_time - run_start_time, start_time - run_start_time, completion_time - run_start_time,
+						std::chrono::nanoseconds(job_time.load(std::memory_order::relaxed)) });
+				}
+			}
+		}
+		finish(worker);
+	}
+
+	void JobGraphNodeRun::finish(Worker& worker) {
+		// Descendants of a cancelled node are skipped as they are released. Cancelled runs skip every node anyway.
+		const bool cancels_successors = cancellation && cancelled.load(std::memory_order::relaxed);
+		if (node) {
+			if (cancels_successors) {
+				for (const JobGraphNode* successor : node->successors) {
+					graph_run->node_runs[successor->index].cancel();
+				}
+			}
+			release_successors(worker, *graph_run, node->successors);
+		}
+		// Closing the list makes nodes created from now on see this node as completed.
+		for (SuccessorLink* link = dynamic_successors.exchange(&completed_marker, std::memory_order::acq_rel); link; link = link->next) {
+			if (cancels_successors) {
+				link->successor->cancel();
+			}
+			link->successor->predecessor_completed(worker);
+		}
+		if (parent) {
+			parent->job_completed(worker);
+		}
+		// Last, since the run state may be reused as soon as the run is completed.
+		graph_run->job_completed();
+	}
+
+	void JobGraphNodeRun::release_successors(Worker& worker, JobGraphRun& graph_run, std::span<JobGraphNode* const> successors) {
+		// The successors keep the run from completing, so the release Jobs can be free Jobs of the run.
+		while (successors.size() > successor_release_batch_size) {
+			const size_t half = successors.size() / 2;
+			JobSpawner(worker, nullptr, &graph_run).spawn(run_successor_release, SuccessorRelease{ &graph_run, successors.data() + half, static_cast<Size>(successors.size() - half) }, false);
+			successors = successors.first(half);
+		}
+		for (const JobGraphNode* successor : successors) {
+			graph_run.node_runs[successor->index].predecessor_completed(worker);
+		}
+	}
+
+	void JobGraphNodeRun::run_successor_release(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo&) {
+		const SuccessorRelease& release = *static_cast<const SuccessorRelease*>(param_buffer);
+		release_successors(job_spawner.worker, *release.graph_run, std::span<JobGraphNode* const>(release.successors, release.successor_amount));
+	}
+
+	bool JobGraphNodeRun::is_on_critical_path() const {
+		return node && node->is_on_critical_path();
+	}
+
+	void JobGraphNodeRun::add_successor(JobGraphNodeRun& successor, SuccessorLink& link) {
+		successor.predecessor_amount.fetch_add(1, std::memory_order::relaxed);
+		link.successor = &successor;
+		SuccessorLink* head = dynamic_successors.load(std::memory_order::acquire);
+		do {
+			if (head == &completed_marker) {
+				// Can't reach zero here, since the creator still holds the successor back.
+				successor.predecessor_amount.fetch_sub(1, std::memory_order::relaxed);
+				return;
+			}
+			link.next = head;
+		} while (!dynamic_successors.compare_exchange_weak(head, &link, std::memory_order::release, std::memory_order::acquire));
+	}
+
+	void JobGraphNodeRun::predecessor_completed(Worker& worker) {
+		const Size old_predecessor_amount = predecessor_amount.fetch_sub(1, std::memory_order::acq_rel);
+		assert(old_predecessor_amount > 0);
+		if (old_predecessor_amount == 1) {
+			if constexpr (node_timing) {
+				ready_time = std::chrono::steady_clock::now();
+			}
+			if (!enabled || is_cancelled() || !should_run()) {
+				skip(worker);
+			}
+			else if (frame_coherent_placement && node && node->get_last_worker() != JobGraphNode::no_worker) {
+				// Another run of the graph may change the worker in between, but it's never reset to no_worker.
+				graph_run->scheduler.place_job(&root_job, node->get_last_worker(), is_on_critical_path(), worker);
+			}
+			else if (is_on_critical_path()) {
+				worker.push_priority(&root_job);
+			}
+			else {
+				worker.push(&root_job);
+			}
+		}
+	}
+
+	bool JobGraphNodeRun::should_run() const {
+		return !node || !node->condition || node->condition(root_job.param_buffer);
+	}
+
+	void JobGraphNodeRun::record_worker(Worker& worker) {
+		node->set_last_worker(worker.statistics.info.get_worker_index());
+	}
+
+	void JobGraphNodeRun::skip(Worker& worker) {
+		// Skipping a node releases its successors, which may be skipped in turn. Those are queued on the worker and skipped by the outermost
+		// call instead of recursively, so that a long chain of skipped nodes can't overflow the stack.
+		worker.skipped_nodes.push_back(this);
+		if (worker.is_skipping_nodes) {
+			return;
+		}
+		worker.is_skipping_nodes = true;
+		while (!worker.skipped_nodes.empty()) {
+			JobGraphNodeRun* node_run = worker.skipped_nodes.back();
+			worker.skipped_nodes.pop_back();
+			node_run->complete_skipped(worker);
+		}
+		worker.is_skipping_nodes = false;
+	}
+
+	void JobGraphNodeRun::complete_skipped(Worker& worker) {
+		assert(unfinished_amount.load(std::memory_order::relaxed) == 1);
+		unfinished_amount.store(0, std::memory_order::relaxed);
+		// The duration of the previous run the node was run in is kept for the critical path, but the timing shows that nothing was run.
+		// Nodes created by Jobs have no JobGraphNode to keep it in.
+		if constexpr (node_timing) {
+			if (node) {
+				const std::chrono::nanoseconds time = ready_time - graph_run->start_time;
+				node->set_last_timing({ time, time, time, std::chrono::nanoseconds::zero() });
+			}
+		}
+		finish(worker);
+	}
+
+	void JobGraphRun::start(const JobGraph& graph) {
+		start(static_cast<Size>(graph.nodes.size()), [&graph](Size index) { return graph.nodes[index].get(); }, graph.get_root_nodes());
+	}
+
+	void JobGraphRun::start(const CompiledJobGraph& graph) {
+		start(graph.node_amount, [&graph](Size index) { return &graph.nodes[index]; }, graph.get_root_nodes());
+	}
+
+	template<typename GetNode>
+	void JobGraphRun::start(Size new_node_amount, GetNode get_node, std::span<JobGraphNode* const> graph_root_nodes) {
+		assert(is_done());
+		if (new_node_amount > node_capacity) {
+			node_runs.reset(new JobGraphNodeRun[new_node_amount]);
+			node_capacity = new_node_amount;
+		}
+		node_amount = new_node_amount;
+		if constexpr (node_timing) {
+			start_time = std::chrono::steady_clock::now();
+		}
+		for (Size i = 0; i != node_amount; i++) {
+			JobGraphNode* node = get_node(i);
+			assert(node->index == i);
+			JobGraphNodeRun& node_run = node_runs[i];
+			node_run.root_job = node->root_job;
+			node_run.root_job.node = &node_run;
+			node_run.root_job.graph_run = this;
+			node_run.predecessor_amount.store(node->initial_predecessor_amount, std::memory_order::relaxed);
+			node_run.unfinished_amount.store(1, std::memory_order::relaxed);
+			node_run.dynamic_successors.store(nullptr, std::memory_order::relaxed);
+			node_run.enabled = node->enabled;
+			node_run.cancelled.store(false, std::memory_order::relaxed);
+			node_run.node = node;
+			node_run.graph_run = this;
+			node_run.parent = nullptr;
+			if constexpr (node_timing) {
+				node_run.job_time.store(0, std::memory_order::relaxed);
+				node_run.ready_time = start_time;
+			}
+		}
+		arena.reset();
+		root_nodes.clear();
+		for (const JobGraphNode* root_node : graph_root_nodes) {
+			JobGraphNodeRun& root_node_run = node_runs[root_node->index];
+			// Root nodes are released when the run is started, which is now.
+			root_node_run.enabled = root_node_run.enabled && root_node_run.should_run();
+			root_nodes.push_back(&root_node_run);
+		}
+		unfinished_amount.store(node_amount, std::memory_order::relaxed);
+		cancelled.store(false, std::memory_order::relaxed);
+		done.store(node_amount == 0, std::memory_order::relaxed);
+	}
+
+	JobGraphNodeRun* JobGraphRun::get_node_run(const JobGraphNode* node) const {
+		assert(node && node->index < node_amount && node_runs[node->index].node == node);
+		return &node_runs[node->index];
+	}
+
+	JobGraphNodeRun* JobGraphRun::create_node(JobFunction* function, const void* params, size_t params_size, JobGraphNodeRun* parent) {
+		static_assert(std::is_trivially_destructible_v<JobGraphNodeRun>, "SharedArena does not run destructors.");
+		JobGraphNodeRun* node_run = new (arena.allocate(sizeof(JobGraphNodeRun), alignof(JobGraphNodeRun))) JobGraphNodeRun();
+		std::memcpy(node_run->root_job.param_buffer, params, params_size);
+		node_run->root_job.function = function;
+		node_run->root_job.node = node_run;
+		node_run->root_job.graph_run = this;
+		node_run->predecessor_amount.store(1, std::memory_order::relaxed);
+		node_run->graph_run = this;
+		node_run->parent = parent;
+		if (parent) {
+			parent->job_added();
+		}
+		job_added();
+		return node_run;
+	}
+
+	JobGraphNodeRun::SuccessorLink* JobGraphRun::create_successor_link() {
+		return new (arena.allocate(sizeof(JobGraphNodeRun::SuccessorLink), alignof(JobGraphNodeRun::SuccessorLink))) JobGraphNodeRun::SuccessorLink{};
+	}
+
+	bool JobGraphRun::cancel() {
+		if (!tracks_completion) {
+			return false;
+		}
+		cancelled.store(true, std::memory_order::relaxed);
+		return true;
+	}
+
+	void JobGraphRun::job_completed() {
+		if (!tracks_completion) {
+			return;
+		}
+		const Size old_unfinished_amount = unfinished_amount.fetch_sub(1, std::memory_order::acq_rel);
+		assert(old_unfinished_amount > 0);
+		if (old_unfinished_amount == 1) {
+			scheduler.run_completed(*this);
+		}
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <span>
+#include <atomic>
+#include <chrono>
+
+#include "Config.h"
+#include "Job.h"
+#include "SharedArena.h"
+
+namespace jobs {
+
+	class JobGraph;
+	class CompiledJobGraph;
+	class JobGraphNode;
+	class JobGraphRun;
+	class Scheduler;
+	class JobSpawner;
+	class WorkerInfo;
+	struct Worker;
+
+	// State of a JobGraphNode in a single run of its graph: a copy of the root Job, and the counters that are modified while running.
+	// Keeping these apart from the node itself allows running the same graph again before the previous run has completed.
+	// Nodes created while running (see JobSpawner::create_node()) only exist as a JobGraphNodeRun, without a JobGraphNode.
+	class JobGraphNodeRun {
+	public:
+		using Size = uint32_t;
+		using AtomicSize = std::atomic<Size>;
+		static_assert(AtomicSize::is_always_lock_free, "JobGraphNodeRun will work without this, but may not be lock-free. It wants to be lock-free.");
+
+		JobGraphNodeRun() = default;
+		JobGraphNodeRun(const JobGraphNodeRun&) = delete;
+		JobGraphNodeRun(JobGraphNodeRun&&) = delete;
+		JobGraphNodeRun& operator=(const JobGraphNodeRun&) = delete;
+		JobGraphNodeRun& operator=(JobGraphNodeRun&&) = delete;
+		// Called by JobSpawner when new Jobs are spawned as sub-Jobs.
+		void job_added(Size amount = 1);
+		// Called by Job before running the root Job.
+		void root_job_started(Worker& worker);
+		// Called by Job after running its function, with node_timing.
+		void add_job_time(std::chrono::nanoseconds duration);
+		// Called by Job after running its function.
+		void job_completed(Worker& worker);
+		Job* get_root_job() { return &root_job; }
+		const Job* get_root_job() const { return &root_job; }
+		bool is_on_critical_path() const;
+		// The node of the graph this is the state of. Null for nodes created while running.
+		const JobGraphNode* get_node() const { return node; }
+		// Makes the node and its descendants be dropped, see JobSpawner::cancel_node().
+		void cancel() { cancelled.store(true, std::memory_order::relaxed); }
+		// True if the node, any node it's a sub-node of, or the run is cancelled.
+		bool is_cancelled() const;
+		// Called by Job instead of running the root Job, when it's dropped.
+		void root_job_dropped(Worker& worker) { skip(worker); }
+		// True once the node and all its sub-Jobs are completed.
+		bool is_completed() const { return dynamic_successors.load(std::memory_order::acquire) == &completed_marker; }
+
+	private:
+		friend struct Job;
+		friend class JobGraphRun;
+		friend class JobSpawner;
+		friend class Scheduler;
+
+		// Entry in the list of successors of a node, added while running.
+		struct SuccessorLink {
+			JobGraphNodeRun* successor;
+			SuccessorLink* next;
+		};
+
+		// Makes successor wait for this node, unless this node is already completed. Called only while successor is held back by its creator.
+		void add_successor(JobGraphNodeRun& successor, SuccessorLink& link);
+		// Called when a predecessor of this node is completed, or when the creator of this node lets it go. Pushes the root Job when ready.
+		void predecessor_completed(Worker& worker);
+		// Evaluates the condition of the node. Only for nodes of the graph, nodes created while running are always run.
+		bool should_run() const;
+		// Sets the worker of the node, with frame_coherent_placement. Defined in the source file, which knows Worker.
+		void record_worker(Worker& worker);
+		// Completes a skipped node without running its root Job.
+		void skip(Worker& worker);
+		// Does the work of skip() for a single node.
+		void complete_skipped(Worker& worker);
+		// Releases the successors, the parent and the run once the node is completed.
+		void finish(Worker& worker);
+		// Releases given successors of a node of given run, spawning Jobs for parts of the list if it's long, see successor_release_batch_size.
+		static void release_successors(Worker& worker, JobGraphRun& graph_run, std::span<JobGraphNode* const> successors);
+		// Params and function of the Jobs spawned by release_successors().
+		struct SuccessorRelease {
+			JobGraphRun* graph_run;
+			JobGraphNode* const* successors;
+			Size successor_amount;
+		};
+		static void run_successor_release(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info);
+
+		// Replaces the list of dynamic successors once the node is completed.
+		static inline SuccessorLink completed_marker{ nullptr, nullptr };
+
+		Job root_job;
+		// The members up to the counters are read before every Job of the node with cancellation and hardly written while running, so they are
+		// kept apart from the counters, as in JobGraphRun.
+		// Copied from the node when the run is started, and for root nodes combined with the result of their condition.
+		bool enabled = true;
+		// Set by cancel(), and by a cancelled predecessor when it's completed.
+		std::atomic<bool> cancelled = false;
+		// Null for nodes created while running.
+		JobGraphNode* node = nullptr;
+		JobGraphRun* graph_run = nullptr;
+		// For nodes created as sub-nodes, the node that is not completed before this one.
+		JobGraphNodeRun* parent = nullptr;
+		// The counters are modified by any worker completing Jobs of this node, so they are kept apart from the root Job and from other nodes.
+		alignas(cacheline_size) AtomicSize predecessor_amount = 0;
+		AtomicSize unfinished_amount = 1;
+		// In nanoseconds, used with node_timing.
+		std::atomic<int64_t> job_time = 0;
+		// Successors added while running. Only modified with atomic operations, as nodes can be added and completed concurrently.
+		std::atomic<SuccessorLink*> dynamic_successors = nullptr;
+		std::chrono::steady_clock::time_point start_time;
+		// Used with node_timing.
+		std::chrono::steady_clock::time_point ready_time;
+	};
+
+	// State of a single run of a JobGraph or a CompiledJobGraph. Keeps track of the unfinished nodes and free Jobs of the run, in order to tell
+	// when the whole run is completed. Owned by Scheduler, which reuses the state for later runs; see Scheduler::run_async().
+	class JobGraphRun {
+	public:
+		using Size = uint32_t;
+		using AtomicSize = JobGraphNodeRun::AtomicSize;
+
+		// The Jobs of a run that does not track completion are not counted, so the run is never completed. Used for Jobs submitted with Scheduler::submit().
+		JobGraphRun(Scheduler& scheduler, bool tracks_completion = true) : scheduler(scheduler), arena(run_arena_block_size), tracks_completion(tracks_completion) {}
+		JobGraphRun(const JobGraphRun&) = delete;
+		JobGraphRun(JobGraphRun&&) = delete;
+		JobGraphRun& operator=(const JobGraphRun&) = delete;
+		JobGraphRun& operator=(JobGraphRun&&) = delete;
+		// Sets up the state for running given graph. May only be called when no Jobs of a previous run using this state remain.
+		void start(const JobGraph& graph);
+		void start(const CompiledJobGraph& graph);
+		// Called by JobSpawner when free Jobs are spawned.
+		void job_added(Size amount = 1);
+		// Called when a free Job or a whole node is completed.
+		void job_completed();
+		bool is_done() const { return done.load(std::memory_order::acquire); }
+		// Makes the remaining Jobs of the run be dropped, see JobSpawner::cancel_run(). Returns false for runs that don't track completion,
+		// which are never reset.
+		bool cancel();
+		bool is_cancelled() const { return cancelled.load(std::memory_order::relaxed); }
+		std::span<JobGraphNodeRun* const> get_root_nodes() const { return root_nodes; }
+		// Returns the state of given node of the graph being run. Asserts that the node belongs to the graph.
+		JobGraphNodeRun* get_node_run(const JobGraphNode* node) const;
+
+	private:
+		friend class JobGraphNodeRun;
+		friend class JobSpawner;
+		friend class Scheduler;
+
+		template<typename GetNode>
+		void start(Size new_node_amount, GetNode get_node, std::span<JobGraphNode* const> graph_root_nodes);
+		// Used by JobSpawner::create_node(). The node is held back from running until predecessor_completed() is called on it once more
+		// than the amount of predecessors added to it.
+		JobGraphNodeRun* create_node(JobFunction* function, const void* params, size_t params_size, JobGraphNodeRun* parent);
+		JobGraphNodeRun::SuccessorLink* create_successor_link();
+
+		Scheduler& scheduler;
+		// Indexed like the nodes of the graph.
+		std::unique_ptr<JobGraphNodeRun[]> node_runs;
+		Size node_capacity = 0;
+		Size node_amount = 0;
+		std::vector<JobGraphNodeRun*> root_nodes;
+		// Used with node_timing.
+		std::chrono::steady_clock::time_point start_time;
+		// Nodes and successor links created while running.
+		SharedArena arena;
+		const bool tracks_completion;
+		// Read before every Job with cancellation, so it's kept apart from the counters below.
+		std::atomic<bool> cancelled = false;
+		// Unfinished nodes and free Jobs.
+		alignas(cacheline_size) AtomicSize unfinished_amount = 0;
+		std::atomic<bool> done = true;
+	};
+
+	inline void JobGraphNodeRun::job_added(Size amount) {
+		unfinished_amount.fetch_add(amount, std::memory_order::relaxed);
+	}
+
+	inline void JobGraphNodeRun::root_job_started(Worker& worker) {
+		if constexpr (critical_path_priority || node_timing || frame_coherent_placement) {
+			start_time = std::chrono::steady_clock::now();
+		}
+		if constexpr (frame_coherent_placement) {
+			if (node) {
+				record_worker(worker);
+			}
+		}
+	}
+
+	inline void JobGraphNodeRun::add_job_time(std::chrono::nanoseconds duration) {
+		job_time.fetch_add(duration.count(), std::memory_order::relaxed);
+	}
+
+	inline bool JobGraphNodeRun::is_cancelled() const {
+		if constexpr (cancellation) {
+			for (const JobGraphNodeRun* node_run = this; node_run; node_run = node_run->parent) {
+				if (node_run->cancelled.load(std::memory_order::relaxed)) {
+					return true;
+				}
+			}
+			return graph_run->is_cancelled();
+		}
+		return false;
+	}
+
+	inline void JobGraphRun::job_added(Size amount) {
+		if (!tracks_completion) {
+			return;
+		}
+		unfinished_amount.fetch_add(amount, std::memory_order::relaxed);
+	}
+
+}
\ No newline at end of file
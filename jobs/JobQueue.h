@@ -2,6 +2,10 @@
 
 #include <atomic>
 #include <limits>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <type_traits>
 #include <cassert>
 
 #include "Config.h"
@@ -10,7 +14,7 @@ namespace jobs {
 
 	struct Job;
 
-	// Fixed-capacity lock-free work-stealing deque. Based on the paper "Correct and Efficient Work-Stealing for Weak Memory Models"
+	// Lock-free work-stealing deque, fixed-capacity unless growable_queue is set in Config.h. Based on the paper "Correct and Efficient Work-Stealing for Weak Memory Models"
 	// by Nhat Minh L, Antoniu Pop, Albert Cohen and Francesco Zappa Nardelli.
 	class JobQueue {
 	public:
@@ -20,68 +24,219 @@ namespace jobs {
 		static constexpr Size size_max = std::numeric_limits<Size>::max();
 		using AtomicJobPtr = std::atomic<Job*>;
 		static_assert(AtomicSize::is_always_lock_free && AtomicJobPtr::is_always_lock_free, "JobQueue will work without this, but may not be lock-free. It wants to be lock-free.");
+		static constexpr Size max_batch_size = static_cast<Size>(max_steal_batch_size);
+		static_assert(max_batch_size >= 1 && 2 * max_steal_batch_size <= queue_capacity, "max_steal_batch_size has to be at least 1, and at most half of queue_capacity.");
 
 		void reset();
+		// Returns false if the queue is full. Only possible with a fixed capacity.
 		bool push(Job* job);
+		// Pushes the given array of Jobs with a single fence and update of bottom. Returns the number of Jobs pushed, fewer than amount if the queue got full.
+		Size push(Job* jobs, Size amount);
 		Job* pop();
 		Job* steal();
+		// Steals up to half of the Jobs in this queue (at most max_steal_batch_size) with a single CAS. Returns one of them,
+		// and pushes the rest to destination, which has to be the calling thread's own queue.
+		Job* steal_batch(JobQueue& destination);
+		// Only meaningful when called by the owner thread. Other threads may see a stale answer.
+		bool is_empty() const;
 
 	private:
-		AtomicJobPtr ring_buffer[queue_capacity];
+		class FixedBuffer {
+		public:
+			Size get_capacity() const { return queue_capacity; }
+			Job* load(Size index) const { return jobs[index % queue_capacity].load(std::memory_order::relaxed); }
+			void store(Size index, Job* job) { jobs[index % queue_capacity].store(job, std::memory_order::relaxed); }
+			bool grow(Size, Size) { return false; }
+			void reset() {}
+
+		private:
+			AtomicJobPtr jobs[queue_capacity];
+		};
+
+		// Circular array that is replaced by one twice the size when full, as described in the paper.
+		class GrowableBuffer {
+		public:
+			static_assert(!growable_queue || (queue_capacity > 0 && (queue_capacity & (queue_capacity - 1)) == 0), "queue_capacity has to be a power of 2 with growable_queue.");
+
+			GrowableBuffer();
+			Size get_capacity() const { return array.load(std::memory_order::relaxed)->capacity; }
+			Job* load(Size index) const;
+			void store(Size index, Job* job);
+			// Called by the owner thread when the buffer is full, i.e. bottom - top == capacity.
+			bool grow(Size top, Size bottom);
+			// Frees the arrays replaced during the run. Only safe when no other thread may be stealing.
+			void reset();
+
+		private:
+			struct Array {
+				Array(Size capacity) : capacity(capacity), jobs(new AtomicJobPtr[capacity]) {}
+
+				const Size capacity;
+				const std::unique_ptr<AtomicJobPtr[]> jobs;
+			};
+
+			std::atomic<Array*> array;
+			// The current array is the last one, the rest have been replaced but may still be read by stealing threads.
+			std::vector<std::unique_ptr<Array>> arrays;
+		};
+
+		std::conditional_t<growable_queue, GrowableBuffer, FixedBuffer> ring_buffer;
 		alignas(cacheline_size) AtomicSize top = 0;
 		alignas(cacheline_size) AtomicSize bottom = 0;
 	};
 
+	inline JobQueue::GrowableBuffer::GrowableBuffer() {
+		arrays.emplace_back(new Array(queue_capacity));
+		array.store(arrays.back().get(), std::memory_order::relaxed);
+	}
+
+	inline Job* JobQueue::GrowableBuffer::load(Size index) const {
+		const Array* local_array = array.load(std::memory_order::acquire);
+		return local_array->jobs[index & (local_array->capacity - 1)].load(std::memory_order::relaxed);
+	}
+
+	inline void JobQueue::GrowableBuffer::store(Size index, Job* job) {
+		Array* local_array = array.load(std::memory_order::relaxed);
+		local_array->jobs[index & (local_array->capacity - 1)].store(job, std::memory_order::relaxed);
+	}
+
+	inline bool JobQueue::GrowableBuffer::grow(Size top, Size bottom) {
+		const Array* old_array = array.load(std::memory_order::relaxed);
+		if (old_array->capacity > size_max / 2) {
+			return false;
+		}
+		arrays.emplace_back(new Array(old_array->capacity * 2));
+		Array* new_array = arrays.back().get();
+		for (Size i = top; i != bottom; i++) {
+			new_array->jobs[i & (new_array->capacity - 1)].store(old_array->jobs[i & (old_array->capacity - 1)].load(std::memory_order::relaxed), std::memory_order::relaxed);
+		}
+		array.store(new_array, std::memory_order::release);
+		return true;
+	}
+
+	inline void JobQueue::GrowableBuffer::reset() {
+		if (arrays.size() > 1) {
+			arrays.front() = std::move(arrays.back());
+			arrays.resize(1);
+		}
+	}
+
 	inline void JobQueue::reset() {
 		bottom.store(0, std::memory_order::seq_cst);
 		top.store(0, std::memory_order::seq_cst);
+		ring_buffer.reset();
 	}
 
 	inline bool JobQueue::push(Job* job) {
 		const Size local_bottom = bottom.load(std::memory_order::relaxed);
 		assert(local_bottom < size_max);
 		const Size local_top = top.load(std::memory_order::acquire);
-		if (local_bottom - local_top == queue_capacity) {
+		if (local_bottom - local_top == ring_buffer.get_capacity() && !ring_buffer.grow(local_top, local_bottom)) {
 			return false;
 		}
-		ring_buffer[local_bottom % queue_capacity].store(job, std::memory_order::relaxed);
+		ring_buffer.store(local_bottom, job);
 		std::atomic_thread_fence(std::memory_order::release);
 		bottom.store(local_bottom + 1, std::memory_order::relaxed);
 		return true;
 	}
 
+	inline bool JobQueue::is_empty() const {
+		return bottom.load(std::memory_order::relaxed) <= top.load(std::memory_order::relaxed);
+	}
+
+	inline JobQueue::Size JobQueue::push(Job* jobs, Size amount) {
+		const Size local_bottom = bottom.load(std::memory_order::relaxed);
+		assert(amount >= 0 && local_bottom <= size_max - amount);
+		const Size local_top = top.load(std::memory_order::acquire);
+		while (ring_buffer.get_capacity() - (local_bottom - local_top) < amount && ring_buffer.grow(local_top, local_bottom)) {}
+		const Size pushed_amount = std::min(amount, ring_buffer.get_capacity() - (local_bottom - local_top));
+		if (pushed_amount == 0) {
+			return 0;
+		}
+		for (Size i = 0; i != pushed_amount; i++) {
+			ring_buffer.store(local_bottom + i, jobs + i);
+		}
+		std::atomic_thread_fence(std::memory_order::release);
+		bottom.store(local_bottom + pushed_amount, std::memory_order::relaxed);
+		return pushed_amount;
+	}
+
 	inline Job* JobQueue::pop() {
-		const Size local_bottom = bottom.load(std::memory_order::relaxed) - 1;
-		bottom.store(local_bottom, std::memory_order::relaxed);
+		for (;;) {
+			const Size local_bottom = bottom.load(std::memory_order::relaxed) - 1;
+			bottom.store(local_bottom, std::memory_order::relaxed);
+			std::atomic_thread_fence(std::memory_order::seq_cst);
+			Size local_top = top.load(std::memory_order::relaxed);
+			if (local_bottom < local_top) {
+				bottom.store(local_bottom + 1, std::memory_order::relaxed);
+				return nullptr;
+			}
+			Job* job = ring_buffer.load(local_bottom);
+			// A batch steal can't reach this Job, no need to synchronize with thieves.
+			if (local_bottom - local_top >= max_batch_size) {
+				return job;
+			}
+			// A thief may be claiming this Job along with the ones above it. Claim all remaining Jobs instead by moving top past them,
+			// then push the ones that were not popped back to the queue, at what is now both its top and bottom.
+			const Size claimed_top = local_top;
+			if (!top.compare_exchange_strong(local_top, local_bottom + 1, std::memory_order::seq_cst, std::memory_order::relaxed)) {
+				bottom.store(local_bottom + 1, std::memory_order::relaxed);
+				if (local_bottom == claimed_top) {
+					return nullptr;
+				}
+				// Some of the Jobs were stolen, but not necessarily all of them.
+				continue;
+			}
+			const Size remaining_amount = local_bottom - claimed_top;
+			for (Size i = 0; i != remaining_amount; i++) {
+				ring_buffer.store(local_bottom + 1 + i, ring_buffer.load(claimed_top + i));
+			}
+			if (remaining_amount != 0) {
+				std::atomic_thread_fence(std::memory_order::release);
+			}
+			bottom.store(local_bottom + 1 + remaining_amount, std::memory_order::relaxed);
+			return job;
+		}
+	}
+
+	inline Job* JobQueue::steal() {
+		Size local_top = top.load(std::memory_order::acquire);
 		std::atomic_thread_fence(std::memory_order::seq_cst);
-		Size local_top = top.load(std::memory_order::relaxed);
-		if (local_bottom < local_top) {
-			bottom.store(local_bottom + 1, std::memory_order::relaxed);
+		const Size local_bottom = bottom.load(std::memory_order::acquire);
+		if (local_top >= local_bottom) {
 			return nullptr;
 		}
-		Job* job = ring_buffer[local_bottom % queue_capacity].load(std::memory_order::relaxed);
-		if (local_bottom > local_top) {
-			return job;
-		}
+		Job* job = ring_buffer.load(local_top);
 		if (!top.compare_exchange_strong(local_top, local_top + 1, std::memory_order::seq_cst, std::memory_order::relaxed)) {
-			bottom.store(local_bottom + 1, std::memory_order::relaxed);
 			return nullptr;
 		}
-		bottom.store(local_bottom + 1, std::memory_order::relaxed);
 		return job;
 	}
 
-	inline Job* JobQueue::steal() {
+	inline Job* JobQueue::steal_batch(JobQueue& destination) {
 		Size local_top = top.load(std::memory_order::acquire);
 		std::atomic_thread_fence(std::memory_order::seq_cst);
 		const Size local_bottom = bottom.load(std::memory_order::acquire);
 		if (local_top >= local_bottom) {
 			return nullptr;
 		}
-		Job* job = ring_buffer[local_top % queue_capacity].load(std::memory_order::relaxed);
-		if (!top.compare_exchange_strong(local_top, local_top + 1, std::memory_order::seq_cst, std::memory_order::relaxed)) {
+		Size amount = std::clamp((local_bottom - local_top) / 2, Size(1), max_batch_size);
+		// The rest of the batch is written to destination before claiming it. If the claim fails, destination's bottom is simply not updated.
+		const Size destination_bottom = destination.bottom.load(std::memory_order::relaxed);
+		const Size destination_top = destination.top.load(std::memory_order::acquire);
+		while (destination.ring_buffer.get_capacity() - (destination_bottom - destination_top) < amount - 1 && destination.ring_buffer.grow(destination_top, destination_bottom)) {}
+		amount = std::min(amount, destination.ring_buffer.get_capacity() - (destination_bottom - destination_top) + 1);
+		Job* job = ring_buffer.load(local_top);
+		for (Size i = 1; i < amount; i++) {
+			destination.ring_buffer.store(destination_bottom + i - 1, ring_buffer.load(local_top + i));
+		}
+		if (!top.compare_exchange_strong(local_top, local_top + amount, std::memory_order::seq_cst, std::memory_order::relaxed)) {
 			return nullptr;
 		}
+		if (amount > 1) {
+			std::atomic_thread_fence(std::memory_order::release);
+			destination.bottom.store(destination_bottom + amount - 1, std::memory_order::relaxed);
+		}
 		return job;
 	}
 
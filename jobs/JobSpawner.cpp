@@ -4,26 +4,126 @@
 #include <cassert>
 #include <cstring>
 
-#include "JobAllocator.h"
-#include "JobQueue.h"
-#include "JobGraph.h"
+#include "JobGraphRun.h"
+#include "Scheduler.h"
+#include "Worker.h"
 
 namespace jobs {
 
 	void JobSpawner::spawn_impl(JobFunction* function, const void* params, size_t params_size, bool is_sub_job) const {
-		Job* job = allocator.allocate();
-		assert(job);
+		Job* job = worker.job_allocator.allocate();
+		if (!job) {
+			run_immediately(function, params, is_sub_job);
+			return;
+		}
 		std::memcpy(job->param_buffer, params, params_size);
 		job->function = function;
+		job->graph_run = graph_run;
 		if (is_sub_job) {
 			job->node = node;
 			node->job_added();
 		}
 		else {
 			job->node = nullptr;
+			graph_run->job_added();
+		}
+		worker.push(job);
+	}
+
+	void JobSpawner::spawn_n_impl(JobFunction* function, const void* params, size_t params_size, uint32_t amount, bool is_sub_job) const {
+		if (amount == 0) {
+			return;
+		}
+		JobGraphNodeRun* job_node = is_sub_job ? node : nullptr;
+		const uint8_t* params_bytes = static_cast<const uint8_t*>(params);
+		while (amount != 0) {
+			uint32_t allocated_amount;
+			Job* jobs = worker.job_allocator.allocate(amount, allocated_amount);
+			if (!jobs) {
+				break;
+			}
+			// Safe to add to the counters in parts, since the current Job keeps them from reaching zero.
+			if (is_sub_job) {
+				node->job_added(allocated_amount);
+			}
+			else {
+				graph_run->job_added(allocated_amount);
+			}
+			for (uint32_t i = 0; i != allocated_amount; i++) {
+				std::memcpy(jobs[i].param_buffer, params_bytes, params_size);
+				jobs[i].function = function;
+				jobs[i].node = job_node;
+				jobs[i].graph_run = graph_run;
+				params_bytes += params_size;
+			}
+			worker.push(jobs, allocated_amount);
+			amount -= allocated_amount;
+		}
+		for (; amount != 0; amount--) {
+			run_immediately(function, params_bytes, is_sub_job);
+			params_bytes += params_size;
+		}
+	}
+
+	void JobSpawner::run_immediately(JobFunction* function, const void* params, bool is_sub_job) const {
+		// The counters are left as they are: The running Job keeps its node and run from completing until this returns.
+		worker.statistics.add_allocation_failure();
+		function(params, JobSpawner(worker, is_sub_job ? node : nullptr, graph_run), worker.statistics.info);
+	}
+
+	JobGraphNodeRun* JobSpawner::create_node_impl(JobFunction* function, const void* params, size_t params_size, std::span<JobGraphNodeRun* const> predecessors, bool is_sub_node) const {
+		assert(!is_sub_node || node);
+		JobGraphNodeRun* new_node = graph_run->create_node(function, params, params_size, is_sub_node ? node : nullptr);
+		for (JobGraphNodeRun* predecessor : predecessors) {
+			// A sub-node waiting for its parent would never run.
+			assert(predecessor && predecessor->graph_run == graph_run && !(is_sub_node && predecessor == node));
+			predecessor->add_successor(*new_node, *graph_run->create_successor_link());
+		}
+		new_node->predecessor_completed(worker);
+		return new_node;
+	}
+
+	void* JobSpawner::allocate_scratch_impl(size_t size, size_t alignment) const {
+		return worker.scratch_allocator.allocate(size, alignment);
+	}
+
+	void JobSpawner::start_read(IoRequest& request, bool is_sub_job) const {
+		assert(!is_sub_job || node);
+		request.node = is_sub_job ? node : nullptr;
+		request.graph_run = graph_run;
+		// Counted like a spawned Job, since the continuation will be completed as one.
+		if (is_sub_job) {
+			node->job_added();
+		}
+		else {
+			graph_run->job_added();
 		}
-		const bool pushed = queue.push(job);
-		assert(pushed);
+		graph_run->scheduler.start_read(request);
+	}
+
+	void JobSpawner::read_continuation_started() const {
+		graph_run->scheduler.io_continuation_started(*graph_run);
+	}
+
+	bool JobSpawner::cancel_run_impl() const {
+		return graph_run->cancel();
+	}
+
+	void JobSpawner::cancel_node_impl(JobGraphNodeRun* node_run) const {
+		assert(node_run && node_run->graph_run == graph_run);
+		node_run->cancel();
+	}
+
+	bool JobSpawner::is_cancelled() const {
+		return node ? node->is_cancelled() : graph_run->is_cancelled();
+	}
+
+	JobGraphNodeRun* JobSpawner::get_node_run(const JobGraphNode* graph_node) const {
+		return graph_run->get_node_run(graph_node);
+	}
+
+	bool JobSpawner::is_queue_empty() const {
+		return worker.job_queue.is_empty();
 	}
 
 }
\ No newline at end of file
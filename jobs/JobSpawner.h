@@ -1,38 +1,237 @@
 #pragma once
 
 #include <type_traits>
+#include <memory>
+#include <span>
+#include <new>
 
 #include "Job.h"
+#include "IoRequest.h"
 
 namespace jobs {
 
-	class JobAllocator;
-	class JobQueue;
 	class JobGraphNode;
+	class JobGraphNodeRun;
+	class JobGraphRun;
+	struct Worker;
 
 	// Passed to Job functions to allow spawning new Jobs in a safe manner. Takes care of using the correct allocator, pushing to the correct queue,
 	// and updating the dependency graph node when a sub-Job is spawned (so that Jobs in dependent nodes are not started prematurely).
 	class JobSpawner {
 	public:
-		JobSpawner(JobAllocator& allocator, JobQueue& queue, JobGraphNode* node) : allocator(allocator), queue(queue), node(node) {}
+		JobSpawner(Worker& worker, JobGraphNodeRun* node, JobGraphRun* graph_run) : worker(worker), node(node), graph_run(graph_run) {}
 		// If is_sub_job == true, the spawned job will be completed before the current dependency graph node is considered completed.
-		// Otherwise, the spawned Job is not part of the dependency graph (but will still be completed before Scheduler::run() returns).
+		// Otherwise, the spawned Job is not part of the dependency graph (but will still be completed before the run it belongs to is completed).
 		template<typename Params>
 		void spawn(JobFunction* function, const Params& params, bool is_sub_job) const;
+		// Spawns a Job running given closure, e.g. a lambda, called either with (const JobSpawner&, WorkerInfo&) or with no arguments.
+		// The closure is copied into Job::param_buffer when it fits, and into the current worker's scratch memory (see allocate_scratch())
+		// otherwise, and called through a function generated for its type, so no heap allocation or virtual call is involved. Like Params,
+		// the closure has to be trivially copyable, so it can capture pointers, references and plain values, but e.g. not a std::string.
+		template<typename Closure>
+		void spawn(const Closure& closure, bool is_sub_job) const;
+		// Spawns one Job per element of the params array, all running the same function. Cheaper than calling spawn() for each: The Jobs are allocated
+		// contiguously, the node is updated only once per chunk of Jobs, and the Jobs are pushed to the queue with a single fence.
+		template<typename Params>
+		void spawn_n(JobFunction* function, const Params* params, uint32_t amount, bool is_sub_job) const;
+		// Reads size bytes at offset from file without blocking the worker, then spawns a Job running continuation. It's called with the result
+		// of the read followed by (const JobSpawner&, WorkerInfo&), or with the result only. The result is the amount of bytes read, as with
+		// pread(), or a negative error code. If is_sub_job == true, the current dependency graph node is not completed before the continuation
+		// has run. The buffer has to stay valid until then. The continuation has the same restrictions as closures passed to spawn().
+		// Needs a non-zero SchedulerConfig::io_queue_depth. On Windows, the file has to be opened with FILE_FLAG_OVERLAPPED.
+		template<typename Closure>
+		void spawn_after_read(FileHandle file, void* buffer, uint32_t size, uint64_t offset, const Closure& continuation, bool is_sub_job) const;
+		// Adds a node to the graph run the current Job belongs to. The node runs once all given predecessors are completed, which may be nodes of
+		// the graph (see get_node_run()) or other nodes created while running. Predecessors which are already completed are skipped.
+		// If is_sub_node == true, the current dependency graph node is not considered completed before the new node, so successors of the current
+		// node wait for it as well. The returned pointer stays valid until the run is completed, and may be passed to other Jobs of the same run.
+		template<typename Params>
+		JobGraphNodeRun* create_node(JobFunction* function, const Params& params, std::span<JobGraphNodeRun* const> predecessors, bool is_sub_node) const;
+		template<typename Params, size_t N>
+		JobGraphNodeRun* create_node(JobFunction* function, const Params& params, JobGraphNodeRun* (&&predecessors)[N], bool is_sub_node) const;
+		template<typename Params>
+		JobGraphNodeRun* create_node(JobFunction* function, const Params& params, bool is_sub_node) const;
+		// Allocates an array of amount default-initialized objects from the current worker's scratch memory, e.g. for params that don't fit into
+		// Job::param_buffer, or for intermediate results. The memory stays valid, and may be used by any Job, until the workers go idle after
+		// the last run in progress is completed; it's never freed individually, so T has to be trivially destructible.
+		template<typename T>
+		T* allocate_scratch(size_t amount) const;
+		// Returns the state of given node in the current run, for use as a predecessor of created nodes.
+		JobGraphNodeRun* get_node_run(const JobGraphNode* node) const;
+		// Null for free Jobs.
+		JobGraphNodeRun* get_current_node_run() const { return node; }
+		// True if the current Job belongs to a dependency graph node, i.e. if it can spawn sub-Jobs.
+		bool has_node() const { return node; }
+		// True if the current worker's own queue has no Jobs left in it. Useful for deciding whether to split work further.
+		bool is_queue_empty() const;
+		// Cancels the run the current Job belongs to, e.g. once a search has found its answer. Jobs of the run that have not started yet are
+		// dropped, their nodes are completed without running anything more, and the run is completed as soon as the Jobs already running return.
+		// Running Jobs can check is_cancelled() to return early. Jobs submitted from outside the workers, continuations of reads and Tasks
+		// are still run, so they should check is_cancelled() themselves, e.g. through get_task_context() in a Task, which is then expected
+		// to return early instead of awaiting more. Returns false without cancelling anything for Jobs submitted with Scheduler::submit() or
+		// submit_background() and the Jobs they spawn, as their runs are never completed, so they could not be started over. Needs
+		// cancellation in Config.h, without which calls don't compile.
+		template<bool enabled = cancellation>
+		bool cancel_run() const;
+		// Cancels given node of the current run and its descendants: the Jobs of the node and of its sub-nodes are dropped like those of a
+		// cancelled run, and its successors, and theirs in turn, are skipped when released (see JobGraphNode::set_enabled()). Needs
+		// cancellation in Config.h as well.
+		template<bool enabled = cancellation>
+		void cancel_node(JobGraphNodeRun* node_run) const;
+		// True if the run or the node of the current Job has been cancelled.
+		bool is_cancelled() const;
 
 	private:
+		friend class JobGraphNodeRun;
+
+		template<typename Closure>
+		static void call_closure(const Closure& closure, const JobSpawner& job_spawner, WorkerInfo& worker_info);
+		// The JobFunctions of closures stored in Job::param_buffer, and of closures stored in scratch memory and pointed to by param_buffer.
+		template<typename Closure>
+		static void run_closure(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info);
+		template<typename Closure>
+		static void run_scratch_closure(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info);
+
+		// A read started by spawn_after_read(), kept in scratch memory until its continuation has run.
+		template<typename Closure>
+		struct ReadOperation : IoRequest {
+			ReadOperation(const Closure& closure) : IoRequest{}, closure(closure) {}
+
+			Closure closure;
+		};
+
+		// The JobFunction of the continuation of a read. Its params are a pointer to the ReadOperation.
+		template<typename Closure>
+		static void run_read_continuation(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info);
+
 		void spawn_impl(JobFunction* function, const void* params, size_t params_size, bool is_sub_job) const;
+		void spawn_n_impl(JobFunction* function, const void* params, size_t params_size, uint32_t amount, bool is_sub_job) const;
+		// Used when out of Job memory.
+		void run_immediately(JobFunction* function, const void* params, bool is_sub_job) const;
+		void* allocate_scratch_impl(size_t size, size_t alignment) const;
+		void start_read(IoRequest& request, bool is_sub_job) const;
+		// Called by the continuation of a read once it has copied out the closure and the result, before calling the closure.
+		void read_continuation_started() const;
+		JobGraphNodeRun* create_node_impl(JobFunction* function, const void* params, size_t params_size, std::span<JobGraphNodeRun* const> predecessors, bool is_sub_node) const;
+		bool cancel_run_impl() const;
+		void cancel_node_impl(JobGraphNodeRun* node_run) const;
 
-		JobAllocator& allocator;
-		JobQueue& queue;
-		JobGraphNode* node;
+		Worker& worker;
+		JobGraphNodeRun* node;
+		JobGraphRun* graph_run;
 	};
 
 	template<typename Params>
 	inline void JobSpawner::spawn(JobFunction* function, const Params& params, bool is_sub_job) const {
 		static_assert(sizeof(Params) <= param_buffer_size, "Params has to fit into Job::param_buffer. Data that does not fit needs to be allocated elsewhere and pointed to in Params.");
-		static_assert(std::is_trivial_v<Params>, "Params has to be a trivial type. The data is memcpy'd into Job::param_buffer.");
+		static_assert(std::is_trivially_copyable_v<Params>, "Params has to be a trivially copyable type. The data is memcpy'd into Job::param_buffer.");
 		spawn_impl(function, &params, sizeof(Params), is_sub_job);
 	}
 
+	template<typename Closure>
+	inline void JobSpawner::spawn(const Closure& closure, bool is_sub_job) const {
+		static_assert(std::is_trivially_copyable_v<Closure>, "Closure has to be a trivially copyable type. It's copied into Job::param_buffer or scratch memory, and never destroyed.");
+		if constexpr (sizeof(Closure) <= param_buffer_size && alignof(Closure) <= alignof(Job)) {
+			spawn_impl(run_closure<Closure>, &closure, sizeof(Closure), is_sub_job);
+		}
+		else {
+			Closure* stored_closure = new (allocate_scratch_impl(sizeof(Closure), alignof(Closure))) Closure(closure);
+			spawn_impl(run_scratch_closure<Closure>, &stored_closure, sizeof(stored_closure), is_sub_job);
+		}
+	}
+
+	template<typename Closure>
+	inline void JobSpawner::call_closure(const Closure& closure, const JobSpawner& job_spawner, WorkerInfo& worker_info) {
+		if constexpr (std::is_invocable_v<const Closure&, const JobSpawner&, WorkerInfo&>) {
+			closure(job_spawner, worker_info);
+		}
+		else {
+			static_assert(std::is_invocable_v<const Closure&>, "Closure has to be callable with (const JobSpawner&, WorkerInfo&) or with no arguments.");
+			closure();
+		}
+	}
+
+	template<typename Closure>
+	inline void JobSpawner::run_closure(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info) {
+		call_closure(*static_cast<const Closure*>(param_buffer), job_spawner, worker_info);
+	}
+
+	template<typename Closure>
+	inline void JobSpawner::run_scratch_closure(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info) {
+		call_closure(**static_cast<Closure* const*>(param_buffer), job_spawner, worker_info);
+	}
+
+	template<typename Closure>
+	inline void JobSpawner::spawn_after_read(FileHandle file, void* buffer, uint32_t size, uint64_t offset, const Closure& continuation, bool is_sub_job) const {
+		static_assert(std::is_trivially_copyable_v<Closure>, "Closure has to be a trivially copyable type. It's copied into scratch memory and never destroyed.");
+		ReadOperation<Closure>* operation = new (allocate_scratch_impl(sizeof(ReadOperation<Closure>), alignof(ReadOperation<Closure>))) ReadOperation<Closure>(continuation);
+		operation->file = file;
+		operation->buffer = buffer;
+		operation->size = size;
+		operation->offset = offset;
+		operation->continuation = run_read_continuation<Closure>;
+		start_read(*operation, is_sub_job);
+	}
+
+	template<typename Closure>
+	inline void JobSpawner::run_read_continuation(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info) {
+		const ReadOperation<Closure>& operation = static_cast<const ReadOperation<Closure>&>(**static_cast<IoRequest* const*>(param_buffer));
+		// Copied out first, since the scratch memory holding the operation may be reset once the read no longer counts as pending.
+		const Closure closure = operation.closure;
+		const int64_t result = operation.result;
+		job_spawner.read_continuation_started();
+		if constexpr (std::is_invocable_v<const Closure&, int64_t, const JobSpawner&, WorkerInfo&>) {
+			closure(result, job_spawner, worker_info);
+		}
+		else {
+			static_assert(std::is_invocable_v<const Closure&, int64_t>, "Closure has to be callable with (int64_t, const JobSpawner&, WorkerInfo&) or with (int64_t).");
+			closure(result);
+		}
+	}
+
+	template<typename Params>
+	inline void JobSpawner::spawn_n(JobFunction* function, const Params* params, uint32_t amount, bool is_sub_job) const {
+		static_assert(sizeof(Params) <= param_buffer_size, "Params has to fit into Job::param_buffer. Data that does not fit needs to be allocated elsewhere and pointed to in Params.");
+		static_assert(std::is_trivially_copyable_v<Params>, "Params has to be a trivially copyable type. The data is memcpy'd into Job::param_buffer.");
+		spawn_n_impl(function, params, sizeof(Params), amount, is_sub_job);
+	}
+
+	template<typename Params>
+	inline JobGraphNodeRun* JobSpawner::create_node(JobFunction* function, const Params& params, std::span<JobGraphNodeRun* const> predecessors, bool is_sub_node) const {
+		static_assert(sizeof(Params) <= param_buffer_size, "Params has to fit into Job::param_buffer. Data that does not fit needs to be allocated elsewhere and pointed to in Params.");
+		static_assert(std::is_trivially_copyable_v<Params>, "Params has to be a trivially copyable type. The data is memcpy'd into Job::param_buffer.");
+		return create_node_impl(function, &params, sizeof(Params), predecessors, is_sub_node);
+	}
+
+	template<typename Params, size_t N>
+	inline JobGraphNodeRun* JobSpawner::create_node(JobFunction* function, const Params& params, JobGraphNodeRun* (&&predecessors)[N], bool is_sub_node) const {
+		return create_node(function, params, std::span<JobGraphNodeRun* const>(predecessors), is_sub_node);
+	}
+
+	template<typename Params>
+	inline JobGraphNodeRun* JobSpawner::create_node(JobFunction* function, const Params& params, bool is_sub_node) const {
+		return create_node(function, params, std::span<JobGraphNodeRun* const>(), is_sub_node);
+	}
+
+	// The template parameter only defers the check to the calls, so that the functions can be declared without cancellation.
+	template<bool enabled>
+	inline bool JobSpawner::cancel_run() const {
+		static_assert(enabled, "Cancelling needs cancellation in Config.h.");
+		return cancel_run_impl();
+	}
+
+	template<bool enabled>
+	inline void JobSpawner::cancel_node(JobGraphNodeRun* node_run) const {
+		static_assert(enabled, "Cancelling needs cancellation in Config.h.");
+		cancel_node_impl(node_run);
+	}
+
+	template<typename T>
+	inline T* JobSpawner::allocate_scratch(size_t amount) const {
+		static_assert(std::is_trivially_destructible_v<T>, "T has to be trivially destructible. Scratch memory is reset without running destructors.");
+		T* objects = static_cast<T*>(allocate_scratch_impl(sizeof(T) * amount, alignof(T)));
+		std::uninitialized_default_construct_n(objects, amount);
+		return objects;
+	}
+
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <type_traits>
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <cassert>
+
+#include "Config.h"
+#include "JobSpawner.h"
+#include "Statistics.h"
+
+namespace jobs {
+
+	// Per-worker partial results of a parallel_reduce(). Like any other data pointed to by Job parameters, needs to outlive the run.
+	// Combine has to be associative and commutative, since the order in which the partial results are combined is not defined.
+	template<typename T, typename Combine = std::plus<T>>
+	class Reduction {
+	public:
+		Reduction(uint32_t worker_amount, const T& identity = T(), const Combine& combine = Combine());
+		// Called by parallel_reduce(). Only touches the partial result of given worker, so no synchronization is needed.
+		void add(uint32_t worker_index, const T& value);
+		// Combines all partial results and resets them to identity, so that the Reduction can be used again in the next run.
+		// Call only after the reduction is completed, e.g. from a node depending on the reducing node, or after Scheduler::run() has returned.
+		T collect();
+		const T& get_identity() const { return identity; }
+		const Combine& get_combine() const { return combine; }
+
+	private:
+		// Every partial result lives on its own cacheline, to prevent false sharing between workers.
+		struct alignas(cacheline_size) Partial {
+			T value;
+		};
+
+		std::vector<Partial> partials;
+		T identity;
+		Combine combine;
+	};
+
+	template<typename T, typename Combine>
+	inline Reduction<T, Combine>::Reduction(uint32_t worker_amount, const T& identity, const Combine& combine)
+		: partials(worker_amount, Partial{ identity })
+		, identity(identity)
+		, combine(combine) {}
+
+	template<typename T, typename Combine>
+	inline void Reduction<T, Combine>::add(uint32_t worker_index, const T& value) {
+		assert(worker_index < partials.size());
+		T& partial = partials[worker_index].value;
+		partial = combine(partial, value);
+	}
+
+	template<typename T, typename Combine>
+	inline T Reduction<T, Combine>::collect() {
+		T result = identity;
+		for (Partial& partial : partials) {
+			result = combine(result, partial.value);
+			partial.value = identity;
+		}
+		return result;
+	}
+
+	// Runs body(i) for every i in [begin, end). Processes the range on the calling worker, splitting it in half and spawning the other half
+	// whenever the worker's own queue runs empty (lazy binary splitting). This way the range is only split as much as there are idle workers
+	// to steal the pieces, and no cutoff needs to be tuned per workload. The spawned pieces are sub-Jobs if the calling Job belongs to a node,
+	// free Jobs otherwise. Body is copied into the Job parameters, so it has the same restrictions as Params in JobSpawner::spawn().
+	// Each Job processing a piece of the range is logged as a user job, so the call should not be wrapped in a UserJobLogger.
+	template<typename Index, typename Body>
+	void parallel_for(const JobSpawner& job_spawner, WorkerInfo& worker_info, Index begin, Index end, const Body& body);
+
+	// Like parallel_for(), but each body(i) returns a value, and the values are combined into given Reduction.
+	template<typename Index, typename T, typename Combine, typename Body>
+	void parallel_reduce(const JobSpawner& job_spawner, WorkerInfo& worker_info, Index begin, Index end, Reduction<T, Combine>& reduction, const Body& body);
+
+	// Used internally by parallel_for().
+	template<typename Index, typename Body>
+	struct ParallelForParams {
+		Body body;
+		Index begin;
+		Index end;
+	};
+
+	// Used internally by parallel_reduce().
+	template<typename Index, typename T, typename Combine, typename Body>
+	struct ParallelReduceParams {
+		Body body;
+		Reduction<T, Combine>* reduction;
+		Index begin;
+		Index end;
+	};
+
+	template<typename Index, typename Body>
+	void parallel_for_job(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info) {
+		const ParallelForParams<Index, Body>* params = static_cast<const ParallelForParams<Index, Body>*>(param_buffer);
+		parallel_for(job_spawner, worker_info, params->begin, params->end, params->body);
+	}
+
+	template<typename Index, typename T, typename Combine, typename Body>
+	void parallel_reduce_job(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info) {
+		const ParallelReduceParams<Index, T, Combine, Body>* params = static_cast<const ParallelReduceParams<Index, T, Combine, Body>*>(param_buffer);
+		parallel_reduce(job_spawner, worker_info, params->begin, params->end, *params->reduction, params->body);
+	}
+
+	template<typename Index, typename Body>
+	inline void parallel_for(const JobSpawner& job_spawner, WorkerInfo& worker_info, Index begin, Index end, const Body& body) {
+		static_assert(std::is_integral_v<Index>, "parallel_for() only supports integral indices.");
+		const UserJobLogger logger(worker_info);
+		while (begin < end) {
+			if (static_cast<size_t>(end - begin) > parallel_grain_size && job_spawner.is_queue_empty()) {
+				const Index middle = begin + (end - begin) / 2;
+				job_spawner.spawn(parallel_for_job<Index, Body>, ParallelForParams<Index, Body>{ body, middle, end }, job_spawner.has_node());
+				end = middle;
+				continue;
+			}
+			const Index grain_end = begin + static_cast<Index>(std::min(static_cast<size_t>(end - begin), parallel_grain_size));
+			for (; begin != grain_end; ++begin) {
+				body(begin);
+			}
+		}
+	}
+
+	template<typename Index, typename T, typename Combine, typename Body>
+	inline void parallel_reduce(const JobSpawner& job_spawner, WorkerInfo& worker_info, Index begin, Index end, Reduction<T, Combine>& reduction, const Body& body) {
+		static_assert(std::is_integral_v<Index>, "parallel_reduce() only supports integral indices.");
+		const UserJobLogger logger(worker_info);
+		const Combine& combine = reduction.get_combine();
+		T partial = reduction.get_identity();
+		while (begin < end) {
+			if (static_cast<size_t>(end - begin) > parallel_grain_size && job_spawner.is_queue_empty()) {
+				const Index middle = begin + (end - begin) / 2;
+				const ParallelReduceParams<Index, T, Combine, Body> params{ body, &reduction, middle, end };
+				job_spawner.spawn(parallel_reduce_job<Index, T, Combine, Body>, params, job_spawner.has_node());
+				end = middle;
+				continue;
+			}
+			const Index grain_end = begin + static_cast<Index>(std::min(static_cast<size_t>(end - begin), parallel_grain_size));
+			for (; begin != grain_end; ++begin) {
+				partial = combine(partial, body(begin));
+			}
+		}
+		reduction.add(worker_info.get_worker_index(), partial);
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "Config.h"
+
+namespace jobs {
+
+	// Lets idle workers block individually until more work is pushed, used by IdlePolicy::SpinThenPark.
+	// A worker announces itself as parked before checking for work one last time, and a pusher checks for parked workers after pushing, with
+	// a full fence on both sides. This way either the parking worker sees the new work, or the pusher sees the parked worker and wakes it up.
+	class ParkingLot {
+	public:
+		using Size = uint32_t;
+		using AtomicSize = std::atomic<Size>;
+		static_assert(AtomicSize::is_always_lock_free, "ParkingLot will work without this, but may not be lock-free. It wants to be lock-free.");
+
+		ParkingLot(Size worker_amount) : worker_amount(worker_amount), slots(new Slot[worker_amount]) {}
+		ParkingLot(const ParkingLot&) = delete;
+		ParkingLot(ParkingLot&&) = delete;
+		ParkingLot& operator=(const ParkingLot&) = delete;
+		ParkingLot& operator=(ParkingLot&&) = delete;
+		// Blocks the calling worker until it's unparked, unless should_stay_awake() returns true when called after announcing the worker as parked.
+		// Returns false if the worker did not block.
+		template<typename Predicate>
+		bool park(Size worker_index, Predicate should_stay_awake);
+		// Wakes up one parked worker, if any, starting the search from the one after worker_index. Cheap when no worker is parked.
+		void unpark_one(Size worker_index);
+		// Wakes up given worker, if parked.
+		void unpark_worker(Size worker_index);
+		// Wakes up all parked workers.
+		void unpark_all();
+
+	private:
+		struct alignas(cacheline_size) Slot {
+			AtomicSize parked = 0;
+		};
+
+		bool unpark(Slot& slot);
+
+		const Size worker_amount;
+		std::unique_ptr<Slot[]> slots;
+		alignas(cacheline_size) AtomicSize parked_amount = 0;
+	};
+
+	template<typename Predicate>
+	inline bool ParkingLot::park(Size worker_index, Predicate should_stay_awake) {
+		Slot& slot = slots[worker_index];
+		slot.parked.store(1, std::memory_order::relaxed);
+		parked_amount.fetch_add(1, std::memory_order::relaxed);
+		std::atomic_thread_fence(std::memory_order::seq_cst);
+		if (should_stay_awake()) {
+			// Someone may have unparked the worker in the meantime, in which case they also took care of parked_amount.
+			unpark(slot);
+			return false;
+		}
+		slot.parked.wait(1, std::memory_order::acquire);
+		return true;
+	}
+
+	inline void ParkingLot::unpark_one(Size worker_index) {
+		std::atomic_thread_fence(std::memory_order::seq_cst);
+		if (parked_amount.load(std::memory_order::relaxed) == 0) {
+			return;
+		}
+		for (Size i = 1; i <= worker_amount; i++) {
+			if (unpark(slots[(worker_index + i) % worker_amount])) {
+				return;
+			}
+		}
+	}
+
+	inline void ParkingLot::unpark_worker(Size worker_index) {
+		std::atomic_thread_fence(std::memory_order::seq_cst);
+		unpark(slots[worker_index]);
+	}
+
+	inline void ParkingLot::unpark_all() {
+		std::atomic_thread_fence(std::memory_order::seq_cst);
+		if (parked_amount.load(std::memory_order::relaxed) == 0) {
+			return;
+		}
+		for (Size i = 0; i != worker_amount; i++) {
+			unpark(slots[i]);
+		}
+	}
+
+	inline bool ParkingLot::unpark(Slot& slot) {
+		if (slot.parked.load(std::memory_order::relaxed) == 0 || slot.parked.exchange(0, std::memory_order::release) == 0) {
+			return false;
+		}
+		parked_amount.fetch_sub(1, std::memory_order::relaxed);
+		slot.parked.notify_one();
+		return true;
+	}
+
+}
\ No newline at end of file
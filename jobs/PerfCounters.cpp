@@ -0,0 +1,134 @@
+#include "PerfCounters.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace jobs {
+
+#if defined(_WIN32)
+
+	PerfCounters::PerfCounters() {
+		group_positions.fill(-1);
+		descriptors.fill(-1);
+		if constexpr (perf_counters) {
+			available_mask = 1u << static_cast<uint32_t>(PerfCounter::Cycles);
+		}
+	}
+
+	PerfCounters::~PerfCounters() {}
+
+	PerfCounterValues PerfCounters::read_os() const {
+		PerfCounterValues values;
+		ULONG64 cycles = 0;
+		QueryThreadCycleTime(GetCurrentThread(), &cycles);
+		values.values[static_cast<uint32_t>(PerfCounter::Cycles)] = cycles;
+		return values;
+	}
+
+#elif defined(__linux__)
+
+	namespace {
+
+		int open_counter(uint32_t type, uint64_t config, int group_descriptor) {
+			perf_event_attr attributes;
+			std::memset(&attributes, 0, sizeof(attributes));
+			attributes.size = sizeof(attributes);
+			attributes.type = type;
+			attributes.config = config;
+			attributes.read_format = PERF_FORMAT_GROUP;
+			// The group is enabled at once when the leader is.
+			attributes.disabled = group_descriptor == -1;
+			// Counting only user space keeps the hardware counters usable with the default perf_event_paranoid setting. Context switches
+			// happen in the kernel, so they can't be counted without it.
+			attributes.exclude_kernel = type == PERF_TYPE_HARDWARE;
+			attributes.exclude_hv = 1;
+			return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, group_descriptor, 0));
+		}
+
+	}
+
+	PerfCounters::PerfCounters() {
+		group_positions.fill(-1);
+		descriptors.fill(-1);
+		if constexpr (!perf_counters) {
+			return;
+		}
+		const struct {
+			uint32_t type;
+			uint64_t config;
+		} counters[perf_counter_amount] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+		};
+		// The first counter that can be opened leads the group.
+		int group_size = 0;
+		for (uint32_t i = 0; i != perf_counter_amount; i++) {
+			descriptors[i] = open_counter(counters[i].type, counters[i].config, group_descriptor);
+			if (descriptors[i] == -1) {
+				continue;
+			}
+			if (group_descriptor == -1) {
+				group_descriptor = descriptors[i];
+			}
+			group_positions[i] = group_size++;
+			available_mask |= 1u << i;
+		}
+		if (group_descriptor != -1) {
+			ioctl(group_descriptor, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(group_descriptor, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	PerfCounters::~PerfCounters() {
+		for (const int descriptor : descriptors) {
+			if (descriptor != -1) {
+				close(descriptor);
+			}
+		}
+	}
+
+	PerfCounterValues PerfCounters::read_os() const {
+		PerfCounterValues values;
+		if (available_mask == 0) {
+			return values;
+		}
+		// With PERF_FORMAT_GROUP, the amount of counters followed by their values.
+		uint64_t buffer[1 + perf_counter_amount] = {};
+		if (::read(group_descriptor, buffer, sizeof(buffer)) <= 0) {
+			return values;
+		}
+		for (uint32_t i = 0; i != perf_counter_amount; i++) {
+			if (group_positions[i] != -1 && static_cast<uint64_t>(group_positions[i]) < buffer[0]) {
+				values.values[i] = buffer[1 + group_positions[i]];
+			}
+		}
+		return values;
+	}
+
+#else
+
+	PerfCounters::PerfCounters() {
+		group_positions.fill(-1);
+		descriptors.fill(-1);
+	}
+
+	PerfCounters::~PerfCounters() {}
+
+	PerfCounterValues PerfCounters::read_os() const {
+		return {};
+	}
+
+#endif
+
+}
\ No newline at end of file
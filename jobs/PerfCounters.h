@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Config.h"
+
+namespace jobs {
+
+	enum class PerfCounter : uint32_t {
+		Cycles,
+		Instructions,
+		// Last level cache misses.
+		CacheMisses,
+		ContextSwitches
+	};
+
+	constexpr uint32_t perf_counter_amount = 4;
+
+	// Values of the counters in PerfCounter order. Unavailable counters read as zero.
+	struct PerfCounterValues {
+		std::array<uint64_t, perf_counter_amount> values{};
+
+		uint64_t operator[](PerfCounter counter) const { return values[static_cast<uint32_t>(counter)]; }
+		PerfCounterValues operator-(const PerfCounterValues& other) const;
+		PerfCounterValues& operator+=(const PerfCounterValues& other);
+	};
+
+	// Hardware and OS performance counters of the thread that created the object, used with perf_counters. On Linux, uses perf_event_open, with
+	// all counters in one group so that they are read with a single system call. On Windows, only cycles are available, from QueryThreadCycleTime.
+	// Counters the platform, hardware or permissions don't allow are left out.
+	class PerfCounters {
+	public:
+		PerfCounters();
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters(PerfCounters&&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+		PerfCounters& operator=(PerfCounters&&) = delete;
+		~PerfCounters();
+		// May only be called by the thread that created the object. Returns zeros, without a system call, when perf_counters is disabled.
+		PerfCounterValues read() const;
+		// Bit i is set if the PerfCounter with value i is available.
+		uint32_t get_available_mask() const { return available_mask; }
+
+	private:
+		PerfCounterValues read_os() const;
+
+		// Only used on Linux. The position of each counter in the values read from the group is -1 if the counter is not available.
+		std::array<int, perf_counter_amount> group_positions;
+		std::array<int, perf_counter_amount> descriptors;
+		int group_descriptor = -1;
+		uint32_t available_mask = 0;
+	};
+
+	inline PerfCounterValues PerfCounterValues::operator-(const PerfCounterValues& other) const {
+		PerfCounterValues difference;
+		for (uint32_t i = 0; i != perf_counter_amount; i++) {
+			difference.values[i] = values[i] - other.values[i];
+		}
+		return difference;
+	}
+
+	inline PerfCounterValues& PerfCounterValues::operator+=(const PerfCounterValues& other) {
+		for (uint32_t i = 0; i != perf_counter_amount; i++) {
+			values[i] += other.values[i];
+		}
+		return *this;
+	}
+
+	inline PerfCounterValues PerfCounters::read() const {
+		if constexpr (perf_counters) {
+			return read_os();
+		}
+		else {
+			return {};
+		}
+	}
+
+}
\ No newline at end of file
@@ -1,172 +1,943 @@
 #include "Scheduler.h"
 
 #include <thread>
-#include <random>
 #include <algorithm>
 #include <cassert>
+#include <string>
+#include <utility>
 
 #include "Config.h"
 #include "Job.h"
 #include "JobQueue.h"
 #include "JobAllocator.h"
 #include "JobGraph.h"
+#include "JobGraphRun.h"
+#include "SharedJobQueue.h"
+#include "InjectionQueue.h"
+#include "IoService.h"
+#include "ParkingLot.h"
+#include "Worker.h"
 #include "Statistics.h"
 
 namespace jobs {
 
-	struct Scheduler::Worker {
-		Worker(Size index, Size worker_amount, JobChunkAllocator& chunk_allocator)
-			: job_allocator(chunk_allocator)
-			, random_generator(0xbabe + index)
-			, steal_distribution(1u + index, std::max(worker_amount - 1u, 1u) + index)
-			, statistics(index) {}
-
-		JobAllocator job_allocator;
-		JobQueue job_queue;
-		std::minstd_rand random_generator;
-		std::uniform_int_distribution<Size> steal_distribution;
-		WorkerStatistics statistics;
-	};
-
-	Scheduler::Scheduler(Size desired_worker_amount, Size desired_allocation_chunk_amount) : worker_amount(std::max(desired_worker_amount, 1u)), workers(worker_amount), sync_point(worker_amount) {
-		chunk_allocator.reset(new JobChunkAllocator(std::max(desired_allocation_chunk_amount, worker_amount)));
+	namespace {
+
+		bool needs_topology(const SchedulerConfig& config) {
+			return config.worker_amount == 0 || config.victim_policy == VictimPolicy::Topology || config.pin_workers || !config.reserved_processors.empty();
+		}
+
+		std::vector<uint32_t> get_available_processors(const ProcessorTopology& topology, const std::vector<uint32_t>& reserved_processors) {
+			std::vector<uint32_t> available;
+			for (const ProcessorTopology::Processor& processor : topology.processors) {
+				if (std::find(reserved_processors.begin(), reserved_processors.end(), processor.id) == reserved_processors.end()) {
+					available.push_back(processor.id);
+				}
+			}
+			return available;
+		}
+
+		SchedulerConfig make_config(uint32_t worker_amount, uint32_t allocation_chunk_amount, VictimPolicy victim_policy) {
+			SchedulerConfig config;
+			config.worker_amount = std::max(worker_amount, 1u);
+			config.allocation_chunk_amount = allocation_chunk_amount;
+			config.victim_policy = victim_policy;
+			return config;
+		}
+
+	}
+
+	Scheduler::Scheduler(Size desired_worker_amount, Size desired_allocation_chunk_amount, VictimPolicy victim_policy)
+		: Scheduler(make_config(desired_worker_amount, desired_allocation_chunk_amount, victim_policy)) {}
+
+	Scheduler::Scheduler(const SchedulerConfig& config)
+		: config(config)
+		, topology(needs_topology(config) ? ProcessorTopology::detect() : ProcessorTopology())
+		, worker_amount(config.worker_amount ? config.worker_amount : std::max(static_cast<Size>(get_available_processors(topology, config.reserved_processors).size()), 1u))
+		, workers(worker_amount)
+		, sync_point(worker_amount)
+		, active_worker_amount(config.active_worker_amount ? std::min(config.active_worker_amount, worker_amount) : worker_amount) {
+		assert((worker_statistics || !config.elastic_workers) && "SchedulerConfig::elastic_workers needs worker_statistics.");
+		// Resolve the processors of each worker before any of them is created.
+		const std::vector<uint32_t> available = get_available_processors(topology, config.reserved_processors);
+		worker_processors.resize(worker_amount);
+		for (Size i = 0; i != worker_amount; i++) {
+			if (i < config.worker_processors.size() && !config.worker_processors[i].empty()) {
+				worker_processors[i] = config.worker_processors[i];
+			}
+			else if (config.pin_workers && !available.empty()) {
+				worker_processors[i] = { available[i % available.size()] };
+			}
+			else if (!config.reserved_processors.empty()) {
+				worker_processors[i] = available;
+			}
+		}
+		if (config.victim_policy == VictimPolicy::Topology) {
+			const auto& processors = topology.processors;
+			for (Size i = 0; i != worker_amount; i++) {
+				const ProcessorTopology::Processor* home = &processors[i % processors.size()];
+				if (!worker_processors[i].empty()) {
+					const auto found = std::find_if(processors.begin(), processors.end(), [&](const auto& processor) { return processor.id == worker_processors[i].front(); });
+					if (found != processors.end()) {
+						home = &*found;
+					}
+				}
+				worker_home_processors.push_back(home);
+			}
+		}
+
+		chunk_allocator.reset(new JobChunkAllocator(std::max(config.allocation_chunk_amount, worker_amount), config.max_allocation_chunk_amount));
+		if constexpr (queue_overflow_policy == QueueOverflowPolicy::SharedQueue) {
+			shared_queue.reset(new SharedJobQueue(shared_queue_capacity));
+		}
+		if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+			parking_lot.reset(new ParkingLot(worker_amount));
+		}
+		injection_queue.reset(new InjectionQueue(injection_queue_capacity));
+		submitted_run.reset(new JobGraphRun(*this, false));
+		if (config.background_worker_amount) {
+			background_chunk_allocator.reset(new JobChunkAllocator(config.background_worker_amount, config.max_allocation_chunk_amount));
+			if constexpr (queue_overflow_policy == QueueOverflowPolicy::SharedQueue) {
+				background_shared_queue.reset(new SharedJobQueue(shared_queue_capacity));
+			}
+			if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+				background_parking_lot.reset(new ParkingLot(config.background_worker_amount));
+			}
+			background_injection_queue.reset(new InjectionQueue(injection_queue_capacity));
+			background_run.reset(new JobGraphRun(*this, false));
+			background_workers.resize(config.background_worker_amount);
+		}
+		if (config.io_queue_depth) {
+			io_service.reset(new IoService(*this, config.io_queue_depth));
+		}
+		elastic_work_durations.assign(worker_amount, std::chrono::nanoseconds::zero());
 		threads.reserve(worker_amount - 1);
 		for (Size i = 1; i != worker_amount; i++) {
 			threads.emplace_back(&Scheduler::thread_loop, this, i);
 		}
+		background_threads.reserve(background_workers.size());
+		for (Size i = 0; i != background_workers.size(); i++) {
+			background_threads.emplace_back(&Scheduler::background_thread_loop, this, i);
+		}
+		if (config.configure_calling_thread) {
+			configure_thread(0);
+		}
 		create_worker(0);
+		// Workers steal from each other as soon as a run starts, so all of them need to exist first.
+		sync_point.arrive_and_wait();
+		// From now on, only the active workers sync. None of them arrives again before a run has started.
+		sync_point.set_participant_amount(active_worker_amount.load(std::memory_order::relaxed));
 	}
 
 	Scheduler::~Scheduler() {
+		// Complete any runs still in progress before stopping the threads.
+		if (state.load(std::memory_order::seq_cst) == State::Work) {
+			participate(nullptr);
+		}
 		state.store(State::Quit, std::memory_order::seq_cst);
-		state.notify_all();
+		wake_generation.fetch_add(1, std::memory_order::seq_cst);
+		wake_generation.notify_all();
+		// Inactive workers only wake up for the active amount changing.
+		active_worker_amount.store(worker_amount, std::memory_order::seq_cst);
+		active_worker_amount.notify_all();
 		for (std::thread& thread : threads) {
 			thread.join();
 		}
+		if (background_parking_lot) {
+			background_parking_lot->unpark_all();
+		}
+		for (std::thread& thread : background_threads) {
+			thread.join();
+		}
 	}
 
 	void Scheduler::set_job_graph(const JobGraph* graph) {
 		job_graph = graph;
+		compiled_job_graph = nullptr;
+	}
+
+	void Scheduler::set_job_graph(const CompiledJobGraph* graph) {
+		job_graph = nullptr;
+		compiled_job_graph = graph;
 	}
 
 	void Scheduler::run() {
-		assert(job_graph);
-		state.store(State::Work, std::memory_order::seq_cst);
-		state.notify_all();
-		stealer_amount.store(0, std::memory_order::seq_cst);
-		active_amount.store(worker_amount, std::memory_order::seq_cst);
+		assert(job_graph || compiled_job_graph);
+		RunHandle handle = job_graph ? run_async(job_graph) : run_async(compiled_job_graph);
+		wait(handle);
+	}
+
+	RunHandle Scheduler::run_async(const JobGraph* graph) {
+		assert(graph);
+		JobGraphRun& graph_run = acquire_graph_run();
+		graph_run.start(*graph);
+		return start_run(graph_run);
+	}
+
+	RunHandle Scheduler::run_async(const CompiledJobGraph* graph) {
+		assert(graph);
+		JobGraphRun& graph_run = acquire_graph_run();
+		graph_run.start(*graph);
+		return start_run(graph_run);
+	}
+
+	void Scheduler::wait(RunHandle& handle) {
+		assert(handle.graph_run);
+		JobGraphRun* graph_run = std::exchange(handle.graph_run, nullptr);
+		if (state.load(std::memory_order::seq_cst) == State::Work) {
+			participate(graph_run);
+		}
+		assert(graph_run->is_done());
+		free_graph_runs.push_back(graph_run);
+	}
+
+	void Scheduler::set_active_worker_amount(Size amount) {
+		assert(state.load(std::memory_order::seq_cst) == State::Wait && "The active worker amount may only be changed while no runs are in progress.");
+		amount = std::clamp(amount, Size(1), worker_amount);
+		if (amount == active_worker_amount.load(std::memory_order::relaxed)) {
+			return;
+		}
+		// All workers have left the barrier and stopped stealing, so both can be changed. Workers that wake up for the next run see the new
+		// amount before the new state.
+		sync_point.set_participant_amount(amount);
+		for (Size i = 0; i != amount; i++) {
+			workers[i]->victim_selector.set_tiers(get_victim_tiers(i, amount));
+		}
+		const Size previous_amount = active_worker_amount.exchange(amount, std::memory_order::seq_cst);
+		if (amount > previous_amount) {
+			active_worker_amount.notify_all();
+		}
+		else {
+			// Workers left out are still waiting for a run; wake them up to wait for the active amount instead.
+			wake_generation.fetch_add(1, std::memory_order::seq_cst);
+			wake_generation.notify_all();
+		}
+	}
 
-		run_worker(0);
+	bool Scheduler::submit_impl(JobFunction* function, const void* params, size_t params_size) {
+		if (!injection_queue->push(function, params, params_size, nullptr, submitted_run.get())) {
+			return false;
+		}
+		if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+			parking_lot->unpark_one(worker_amount - 1);
+		}
+		return true;
+	}
 
-		chunk_allocator->reset(); // JobChunkAllocator::reset(), not unique_ptr::reset().
+	bool Scheduler::submit_background_impl(JobFunction* function, const void* params, size_t params_size) {
+		assert(background_injection_queue && "The background lane needs a non-zero SchedulerConfig::background_worker_amount.");
+		if (!background_injection_queue->push(function, params, params_size, nullptr, background_run.get())) {
+			return false;
+		}
+		if (background_parking_lot) {
+			background_parking_lot->unpark_one(0);
+		}
+		return true;
+	}
+
+	Job* Scheduler::take_submitted_job(Worker& worker) {
+		if (injection_queue->is_empty()) {
+			return nullptr;
+		}
+		// Allocated before popping, so that a popped Job always has a place to go. An unused Job is given back as if it was completed.
+		Job* job = worker.job_allocator.allocate();
+		if (!job) {
+			return nullptr;
+		}
+		if (!injection_queue->pop(*job)) {
+			worker.job_allocator.job_completed(job);
+			return nullptr;
+		}
+		return job;
+	}
+
+	void Scheduler::start_read(IoRequest& request) {
+		assert(io_service && "Asynchronous I/O needs a non-zero SchedulerConfig::io_queue_depth.");
+		AtomicSize& pending_amount = is_background_run(request.graph_run) ? pending_background_io_amount : pending_io_amount;
+		pending_amount.fetch_add(1, std::memory_order::seq_cst);
+		io_service->read(request);
+	}
+
+	void Scheduler::io_completed(IoRequest& request) {
+		// The continuation is the only way for the read's node to complete, so it has to get to the workers eventually.
+		// Continuations of background Jobs stay in the background lane, like everything else spawned by them.
+		IoRequest* request_pointer = &request;
+		const bool in_background = is_background_run(request.graph_run);
+		InjectionQueue& queue = in_background ? *background_injection_queue : *injection_queue;
+		while (!queue.push(request.continuation, &request_pointer, sizeof(request_pointer), request.node, request.graph_run)) {
+			std::this_thread::yield();
+		}
+		if (in_background) {
+			if (background_parking_lot) {
+				background_parking_lot->unpark_one(0);
+			}
+		}
+		else if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+			parking_lot->unpark_one(worker_amount - 1);
+		}
+	}
+
+	void Scheduler::io_continuation_started(const JobGraphRun& graph_run) {
+		AtomicSize& pending_amount = is_background_run(&graph_run) ? pending_background_io_amount : pending_io_amount;
+		pending_amount.fetch_sub(1, std::memory_order::seq_cst);
+	}
+
+	bool RunHandle::is_done() const {
+		assert(graph_run);
+		return graph_run->is_done();
 	}
 
 	void Scheduler::write_statistics(std::ostream& out_stream) const {
 		for (auto& worker : workers) {
 			worker->statistics.write(out_stream);
 		}
+		for (auto& worker : background_workers) {
+			worker->statistics.write(out_stream);
+		}
 	}
 
 	void Scheduler::reset_statistics() {
 		for (auto& worker : workers) {
 			worker->statistics.reset();
 		}
+		for (auto& worker : background_workers) {
+			worker->statistics.reset();
+		}
+	}
+
+	void Scheduler::write_trace(std::ostream& out_stream) const {
+		std::vector<const TraceBuffer*> worker_traces;
+		for (auto& worker : workers) {
+			worker_traces.push_back(&worker->trace);
+		}
+		for (auto& worker : background_workers) {
+			worker_traces.push_back(&worker->trace);
+		}
+		write_chrome_trace(out_stream, worker_traces);
+	}
+
+	void Scheduler::reset_trace() {
+		for (auto& worker : workers) {
+			worker->trace.clear();
+		}
+		for (auto& worker : background_workers) {
+			worker->trace.clear();
+		}
 	}
 
 	void Scheduler::thread_loop(Size worker_index) {
+		// Configure the thread before creating the worker, so that its memory is first touched on the processor it's pinned to.
+		configure_thread(worker_index);
 		create_worker(worker_index);
+		sync_point.arrive_and_wait();
 		for (;;) {
-			state.wait(State::Wait, std::memory_order::seq_cst);
-			if (state.load(std::memory_order::seq_cst) == State::Quit) {
+			// Read first, so that a wake-up after the amount or the state read below is not missed.
+			const Size generation_seen = wake_generation.load(std::memory_order::seq_cst);
+			// Inactive workers wait for the active amount instead, so that runs don't wake them up.
+			const Size active_amount_seen = active_worker_amount.load(std::memory_order::seq_cst);
+			if (worker_index >= active_amount_seen) {
+				active_worker_amount.wait(active_amount_seen, std::memory_order::seq_cst);
+				continue;
+			}
+			const State current_state = state.load(std::memory_order::seq_cst);
+			if (current_state == State::Quit) {
 				break;
 			}
+			if (current_state == State::Wait) {
+				wake_generation.wait(generation_seen, std::memory_order::seq_cst);
+				continue;
+			}
 			run_worker(worker_index);
 		}
 	}
 
+	void Scheduler::configure_thread(Size worker_index) const {
+		// Failures are not fatal: the worker still works, just without the requested placement or priority.
+		set_current_thread_affinity(worker_processors[worker_index]);
+		if (config.thread_priority != ThreadPriority::Normal) {
+			set_current_thread_priority(config.thread_priority);
+		}
+		if (!config.thread_name_prefix.empty()) {
+			set_current_thread_name(config.thread_name_prefix + std::to_string(worker_index));
+		}
+	}
+
 	void Scheduler::create_worker(Size index) {
-		workers[index].reset(new Worker(index, worker_amount, *chunk_allocator));
+		const uint32_t trace_capacity = trace_events ? config.trace_event_capacity : 0;
+		const Size active = active_worker_amount.load(std::memory_order::relaxed);
+		workers[index].reset(new Worker(index, *chunk_allocator, shared_queue.get(), parking_lot.get(), get_victim_tiers(index, active), trace_capacity));
 	}
 
-	void Scheduler::run_worker(Size index) {
-		sync_point.arrive_and_wait();
-		Worker& worker = *workers[index];
-		const Timer timer;
+	std::vector<std::vector<Scheduler::Size>> Scheduler::get_victim_tiers(Size worker_index, Size active_amount) const {
+		// Only a worker with no one else to steal from steals from itself. Inactive workers get tiers too, though they don't steal.
+		if (active_amount == 1 && worker_index == 0) {
+			return { { worker_index } };
+		}
+		if (config.victim_policy == VictimPolicy::Random) {
+			std::vector<Size> victims;
+			for (Size i = 0; i != active_amount; i++) {
+				if (i != worker_index) {
+					victims.push_back(i);
+				}
+			}
+			return { victims };
+		}
+		// Tiers: same core, same L3 cache, same NUMA node, the rest.
+		std::vector<std::vector<Size>> tiers(4);
+		const ProcessorTopology::Processor& own = *worker_home_processors[worker_index];
+		for (Size i = 0; i != active_amount; i++) {
+			if (i == worker_index) {
+				continue;
+			}
+			const ProcessorTopology::Processor& other = *worker_home_processors[i];
+			if (other.core == own.core) {
+				tiers[0].push_back(i);
+			}
+			else if (other.l3_cache == own.l3_cache) {
+				tiers[1].push_back(i);
+			}
+			else if (other.numa_node == own.numa_node) {
+				tiers[2].push_back(i);
+			}
+			else {
+				tiers[3].push_back(i);
+			}
+		}
+		std::erase_if(tiers, [](const std::vector<Size>& tier) { return tier.empty(); });
+		return tiers;
+	}
 
-		// Start by running the root jobs of all root nodes (nodes that do not depend on other nodes).
-		for (Size i = index; const Job* root_job = job_graph->get_root_job(i); i += worker_amount) {
-			root_job->run(worker.job_allocator, worker.job_queue, worker.statistics.info);
-			worker.statistics.add_own_job();
+	JobGraphRun& Scheduler::acquire_graph_run() {
+		if (free_graph_runs.empty()) {
+			graph_runs.emplace_back(new JobGraphRun(*this));
+			return *graph_runs.back();
 		}
-		worker.statistics.add_work_timing(timer);
+		JobGraphRun* graph_run = free_graph_runs.back();
+		free_graph_runs.pop_back();
+		return *graph_run;
+	}
 
-		// Run jobs as long as there is work to do.
-		work_loop(worker);
+	RunHandle Scheduler::start_run(JobGraphRun& graph_run) {
+		if (graph_run.is_done()) {
+			// Nothing to run.
+			return RunHandle(&graph_run);
+		}
+		runs_in_flight.fetch_add(1, std::memory_order::seq_cst);
+		if (state.load(std::memory_order::seq_cst) == State::Wait) {
+			// No workers are running, so the counters can be reset safely.
+			stealer_amount.store(0, std::memory_order::seq_cst);
+			active_amount.store(active_worker_amount.load(std::memory_order::relaxed), std::memory_order::seq_cst);
+			if (is_elastic()) {
+				run_start_time = std::chrono::steady_clock::now();
+			}
+			state.store(State::Work, std::memory_order::seq_cst);
+			wake_generation.fetch_add(1, std::memory_order::seq_cst);
+			wake_generation.notify_all();
+		}
+		// Worker 0 belongs to the calling thread, so the root Jobs of all root nodes (nodes that do not depend on other nodes) can be pushed
+		// to its queue, the ones on the critical path first. The other workers steal them from there.
+		Worker& worker = *workers[0];
+		const std::span<JobGraphNodeRun* const> root_nodes = graph_run.get_root_nodes();
+		if constexpr (frame_coherent_placement) {
+			place_root_jobs(graph_run);
+		}
+		else {
+			for (JobGraphNodeRun* root_node : root_nodes) {
+				if (root_node->enabled && root_node->is_on_critical_path()) {
+					worker.push_priority(root_node->get_root_job());
+				}
+			}
+			for (JobGraphNodeRun* root_node : root_nodes) {
+				if (root_node->enabled && !root_node->is_on_critical_path()) {
+					worker.push(root_node->get_root_job());
+				}
+			}
+		}
+		// Skipped after pushing the others, so that the successors they release are queued behind the root Jobs.
+		for (JobGraphNodeRun* root_node : root_nodes) {
+			if (!root_node->enabled) {
+				root_node->skip(worker);
+			}
+		}
+		return RunHandle(&graph_run);
+	}
 
-		if (index == 0) {
+	void Scheduler::place_root_jobs(JobGraphRun& graph_run) {
+		// Nodes that have not been run yet count with their cost hint.
+		const auto get_cost = [](const JobGraphNodeRun* node_run) {
+			const JobGraphNode& node = *node_run->get_node();
+			return (node.get_last_duration() != std::chrono::nanoseconds::zero() ? node.get_last_duration() : node.get_cost_hint()).count();
+		};
+		placed_root_nodes.clear();
+		for (JobGraphNodeRun* root_node : graph_run.get_root_nodes()) {
+			if (root_node->enabled) {
+				placed_root_nodes.push_back(root_node);
+			}
+		}
+		std::stable_sort(placed_root_nodes.begin(), placed_root_nodes.end(), [&](const JobGraphNodeRun* a, const JobGraphNodeRun* b) { return get_cost(a) > get_cost(b); });
+		worker_loads.assign(active_worker_amount.load(std::memory_order::relaxed), 0);
+		for (JobGraphNodeRun* root_node : placed_root_nodes) {
+			const Size worker_index = static_cast<Size>(std::min_element(worker_loads.begin(), worker_loads.end()) - worker_loads.begin());
+			worker_loads[worker_index] += get_cost(root_node);
+			place_job(root_node->get_root_job(), worker_index, root_node->is_on_critical_path(), *workers[0]);
+		}
+	}
+
+	void Scheduler::place_job(Job* job, Size worker_index, bool is_priority, Worker& current) {
+		// The worker may be inactive now, or from a Scheduler with more workers that ran the graph before.
+		Worker* target = worker_index < active_worker_amount.load(std::memory_order::relaxed) ? workers[worker_index].get() : &current;
+		if (target != &current) {
+			if ((critical_path_priority && is_priority && target->priority_lane.push(job)) || target->placed_jobs.push(job)) {
+				if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+					parking_lot->unpark_worker(worker_index);
+				}
+				return;
+			}
+		}
+		if (is_priority) {
+			current.push_priority(job);
+		}
+		else {
+			current.push(job);
+		}
+	}
+
+	void Scheduler::run_completed(JobGraphRun& graph_run) {
+		// In this order, so that a waiting thread seeing the run done also sees whether other runs are in progress.
+		runs_in_flight.fetch_sub(1, std::memory_order::seq_cst);
+		graph_run.done.store(true, std::memory_order::seq_cst);
+		if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+			parking_lot->unpark_worker(0);
+		}
+	}
+
+	void Scheduler::participate(const JobGraphRun* graph_run) {
+		// Stop as soon as the run is done, unless no other runs are in progress, in which case all workers go idle together.
+		Worker& worker = *workers[0];
+		const StatisticsTimer timer;
+		const PerfCounterValues counters = worker.perf_counters.read();
+		const bool idle = work_loop(worker, [this, graph_run]() {
+			return graph_run && graph_run->is_done() && runs_in_flight.load(std::memory_order::seq_cst) != 0;
+		});
+		if (idle) {
 			// Safe to set the state in between the sync_point barriers.
 			state.store(State::Wait, std::memory_order::seq_cst);
+			// Background workers left the processors to the run, so they can go on now.
+			if (background_parking_lot) {
+				background_parking_lot->unpark_all();
+			}
+			finish_work(worker);
+			chunk_allocator->reset(); // JobChunkAllocator::reset(), not unique_ptr::reset().
+			// Nodes created by submitted Jobs are not needed anymore either.
+			submitted_run->arena.reset();
+			if (is_elastic()) {
+				adjust_active_worker_amount();
+			}
 		}
 		worker.statistics.add_total_timing(timer);
+		worker.statistics.add_total_counters(worker.perf_counters.read() - counters);
+	}
+
+	void Scheduler::adjust_active_worker_amount() {
+		elastic_run_duration += std::chrono::steady_clock::now() - run_start_time;
+		if (++elastic_period_amount < std::max(config.elastic_window_amount, 1u)) {
+			return;
+		}
+		// The active workers have passed finish_work(), so their statistics are not being written anymore.
+		const Size active = active_worker_amount.load(std::memory_order::relaxed);
+		std::chrono::nanoseconds work_duration = std::chrono::nanoseconds::zero();
+		for (Size i = 0; i != active; i++) {
+			const std::chrono::nanoseconds current = workers[i]->statistics.get_work_duration();
+			// Statistics that were reset in between count from zero.
+			work_duration += current >= elastic_work_durations[i] ? current - elastic_work_durations[i] : current;
+		}
+		const double available_duration = static_cast<double>(elastic_run_duration.count()) * active;
+		const double utilization = available_duration > 0.0 ? static_cast<double>(work_duration.count()) / available_duration : 0.0;
+		Size target = active;
+		if (utilization < config.elastic_low_utilization && active > config.min_active_worker_amount) {
+			target = active - 1;
+		}
+		else if (utilization > config.elastic_high_utilization) {
+			target = active + 1;
+		}
+		set_active_worker_amount(target);
+		elastic_period_amount = 0;
+		elastic_run_duration = std::chrono::nanoseconds::zero();
+		for (Size i = 0; i != worker_amount; i++) {
+			elastic_work_durations[i] = workers[i]->statistics.get_work_duration();
+		}
+	}
+
+	void Scheduler::run_worker(Size index) {
+		Worker& worker = *workers[index];
+		const StatisticsTimer timer;
+		const PerfCounterValues counters = worker.perf_counters.read();
+		// Run jobs as long as there is work to do.
+		work_loop(worker, []() { return false; });
+		finish_work(worker);
+		worker.statistics.add_total_timing(timer);
+		worker.statistics.add_total_counters(worker.perf_counters.read() - counters);
+	}
+
+	void Scheduler::finish_work(Worker& worker) {
+		assert(runs_in_flight.load(std::memory_order::relaxed) == 0);
+		// Wait for every worker to stop touching the queues of others before resetting, and for every reset to be done before a new run can start.
 		sync_point.arrive_and_wait();
+		assert(worker.overflow_jobs.empty());
 		worker.job_queue.reset();
 		worker.job_allocator.reset();
+		worker.scratch_allocator.reset();
+		sync_point.arrive_and_wait();
 	}
 
-	void Scheduler::work_loop(Worker& worker) {
+	template<typename StopCondition>
+	bool Scheduler::work_loop(Worker& worker, StopCondition should_stop) {
+		// Only changed while no runs are in progress.
+		const Size active_workers = active_worker_amount.load(std::memory_order::relaxed);
 		for (;;) {
 			// Run all jobs in the worker's own queue.
 			{
-				const Timer timer;
-				while (const Job* own_job = worker.job_queue.pop()) {
-					own_job->run(worker.job_allocator, worker.job_queue, worker.statistics.info);
-					worker.statistics.add_own_job();
-				}
+				const StatisticsTimer timer;
+				const PerfCounterValues counters = worker.perf_counters.read();
+				do {
+					while (const Job* own_job = worker.pop()) {
+						if (own_job->is_cancelled()) {
+							own_job->drop(worker);
+						}
+						else {
+							own_job->run(worker);
+							worker.statistics.add_own_job();
+						}
+						if (should_stop()) {
+							worker.statistics.add_work_timing(timer);
+							worker.statistics.add_own_job_counters(worker.perf_counters.read() - counters);
+							return false;
+						}
+					}
+				} while (worker.refill_queue());
 				worker.statistics.add_work_timing(timer);
+				worker.statistics.add_own_job_counters(worker.perf_counters.read() - counters);
+			}
+			if (should_stop()) {
+				return false;
 			}
 
 			// Start stealing work from other workers.
 			stealer_amount.fetch_add(1, std::memory_order::relaxed);
+			Size spin_step = 0;
 			for (;;) {
-				// Steal from another worker selected at random.
-				const Size target_index = worker.steal_distribution(worker.random_generator) % worker_amount;
-				if (const Job* stolen_job = workers[target_index]->job_queue.steal()) {
+				// Jobs placed on this worker by others while it was stealing are taken first, then Jobs that overflowed into the shared queue,
+				// then Jobs submitted from outside the workers, then steal a batch from another worker selected at random.
+				const Job* stolen_job = frame_coherent_placement ? worker.placed_jobs.pop() : nullptr;
+				if (!stolen_job && worker.shared_queue) {
+					stolen_job = worker.shared_queue->pop();
+				}
+				// Submitted Jobs are always run, even if they belong to a cancelled run, since some of them, e.g. continuations of reads, do
+				// bookkeeping of their own.
+				bool is_submitted = false;
+				if (!stolen_job) {
+					stolen_job = take_submitted_job(worker);
+					is_submitted = stolen_job;
+				}
+				Size victim_index = TraceEvent::invalid_id;
+				if (!stolen_job) {
+					victim_index = worker.victim_selector.select();
+					stolen_job = workers[victim_index]->steal(worker);
+				}
+				if (stolen_job) {
+					worker.victim_selector.steal_succeeded();
+					worker.trace.record(TraceEventType::Steal, nullptr, nullptr, victim_index);
 					// Successfully stole a job; first notify potentially waiting workers that there might be more work to be stolen soon.
-					if (stealer_amount.fetch_sub(1, std::memory_order::relaxed) == worker_amount) {
+					if (stealer_amount.fetch_sub(1, std::memory_order::relaxed) == active_workers) {
 						stealer_amount.notify_all();
 					}
-					const Timer timer;
-					stolen_job->run(worker.job_allocator, worker.job_queue, worker.statistics.info);
+					if (!is_submitted && stolen_job->is_cancelled()) {
+						stolen_job->drop(worker);
+						break;
+					}
+					const StatisticsTimer timer;
+					const PerfCounterValues counters = worker.perf_counters.read();
+					stolen_job->run(worker);
 					worker.statistics.add_stolen_job();
 					worker.statistics.add_work_timing(timer);
+					worker.statistics.add_stolen_job_counters(worker.perf_counters.read() - counters);
 					// Go back to working on own queue.
 					break;
 				}
 				worker.statistics.add_failed_steal_attempt();
+				worker.victim_selector.steal_failed();
 
-				// If everyone is stealing, it probably means there is no work left. Get ready to finish the run.
-				if (stealer_amount.load(std::memory_order::relaxed) >= worker_amount) {
+				if (should_stop()) {
+					// Leaving the stealers may change whether everyone is stealing, so wake up the ones waiting for that to change.
+					if (stealer_amount.fetch_sub(1, std::memory_order::seq_cst) == active_workers) {
+						stealer_amount.notify_all();
+					}
+					return false;
+				}
+
+				// If everyone is stealing, it probably means there is no work left. Get ready to finish the run. Reads still in progress will
+				// produce more work though, so keep waiting for them instead. Jobs placed on a worker that was already stealing may not have
+				// been seen by it yet, so with frame_coherent_placement, the queues are checked as well.
+				if (is_work_done_visible() && !(frame_coherent_placement && is_stealable_work_visible())) {
+					// Parked workers count as stealing, so they have to take part in deciding whether work is done.
+					if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+						parking_lot->unpark_all();
+					}
 					// The last worker to enter here notifies others that work is indeed done.
 					if (active_amount.fetch_sub(1, std::memory_order::seq_cst) == 1) {
-						// worker_amount + 1 is used here to mean that everyone is done.
-						stealer_amount.store(worker_amount + 1, std::memory_order::seq_cst);
+						// active_workers + 1 is used here to mean that everyone is done.
+						stealer_amount.store(active_workers + 1, std::memory_order::seq_cst);
 						stealer_amount.notify_all();
 					}
 
-					// Wait until stealer_amount changes, either to worker_amount + 1 (all done), or to a smaller value (another worker managed to steal and may now produce more work).
-					stealer_amount.wait(worker_amount, std::memory_order::seq_cst);
-					if (stealer_amount.load(std::memory_order::seq_cst) > worker_amount) {
-						return;
+					// Wait until stealer_amount changes, either to active_workers + 1 (all done), or to a smaller value (another worker managed to steal and may now produce more work).
+					stealer_amount.wait(active_workers, std::memory_order::seq_cst);
+					if (stealer_amount.load(std::memory_order::seq_cst) > active_workers) {
+						return true;
 					}
 
 					worker.statistics.add_false_wait();
 					active_amount.fetch_add(1, std::memory_order::seq_cst);
 				}
 
-				// Yield to reduce contention; honest work is prioritized over stealing.
+				idle(worker, spin_step, should_stop);
+			}
+		}
+	}
+
+	template<typename StopCondition>
+	void Scheduler::idle(Worker& worker, Size& spin_step, StopCondition should_stop) {
+		if constexpr (idle_policy == IdlePolicy::Yield) {
+			// Yield to reduce contention; honest work is prioritized over stealing.
+			std::this_thread::yield();
+		}
+		else if (spin_step < idle_spin_step_amount) {
+			for (Size i = 0; i != Size(1) << spin_step; i++) {
+				cpu_pause();
+			}
+			spin_step++;
+		}
+		else {
+			// The processor is about to be free, so let a background worker that was holding back have it.
+			if (background_parking_lot && config.background_yields_to_runs) {
+				background_parking_lot->unpark_one(0);
+			}
+			// Block until a worker pushes new Jobs, everyone runs out of work, or the awaited run is done. Stay awake if any has already happened.
+			std::chrono::steady_clock::time_point park_time;
+			if constexpr (trace_events) {
+				park_time = std::chrono::steady_clock::now();
+			}
+			const bool parked = parking_lot->park(worker.statistics.info.get_worker_index(), [this, &should_stop]() {
+				return is_work_done_visible() || is_stealable_work_visible() || should_stop();
+			});
+			if (parked) {
+				worker.statistics.add_park();
+				worker.trace.record(park_time, TraceEventType::Park);
+				worker.trace.record(TraceEventType::Wake);
+			}
+			spin_step = 0;
+		}
+	}
+
+	bool Scheduler::is_work_done_visible() const {
+		return stealer_amount.load(std::memory_order::relaxed) >= active_worker_amount.load(std::memory_order::relaxed) && pending_io_amount.load(std::memory_order::relaxed) == 0;
+	}
+
+	bool Scheduler::is_stealable_work_visible() const {
+		if (shared_queue && !shared_queue->is_empty()) {
+			return true;
+		}
+		if (!injection_queue->is_empty()) {
+			return true;
+		}
+		for (const auto& other : workers) {
+			if (other->has_stealable_jobs()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Scheduler::background_thread_loop(Size index) {
+		configure_background_thread(index);
+		const uint32_t trace_capacity = trace_events ? config.trace_event_capacity : 0;
+		std::vector<Size> victims;
+		for (Size i = 0; i != background_workers.size(); i++) {
+			if (i != index || background_workers.size() == 1) {
+				victims.push_back(i);
+			}
+		}
+		background_workers[index].reset(new Worker(worker_amount + index, *background_chunk_allocator, background_shared_queue.get(), background_parking_lot.get(), { victims }, trace_capacity));
+		Worker& worker = *background_workers[index];
+		// Background workers steal from each other right away, so all of them need to exist first.
+		const Size background_amount = static_cast<Size>(background_workers.size());
+		if (created_background_amount.fetch_add(1, std::memory_order::seq_cst) + 1 == background_amount) {
+			created_background_amount.notify_all();
+		}
+		for (Size created = created_background_amount.load(std::memory_order::seq_cst); created != background_amount; created = created_background_amount.load(std::memory_order::seq_cst)) {
+			created_background_amount.wait(created, std::memory_order::seq_cst);
+		}
+
+		Size spin_step = 0;
+		while (state.load(std::memory_order::seq_cst) != State::Quit) {
+			if (may_run_background() && is_background_work_visible(worker)) {
+				spin_step = 0;
+				begin_background_work();
+				bool stolen = false;
+				while (may_run_background() && state.load(std::memory_order::relaxed) != State::Quit) {
+					const Job* job = take_background_job(worker, stolen);
+					if (!job) {
+						break;
+					}
+					const StatisticsTimer timer;
+					running_background_amount.fetch_add(1, std::memory_order::relaxed);
+					job->run(worker);
+					running_background_amount.fetch_sub(1, std::memory_order::relaxed);
+					if (stolen) {
+						worker.statistics.add_stolen_job();
+					}
+					else {
+						worker.statistics.add_own_job();
+					}
+					worker.statistics.add_work_timing(timer);
+				}
+				end_background_work();
+				continue;
+			}
+			if constexpr (idle_policy == IdlePolicy::Yield) {
+				std::this_thread::yield();
+			}
+			else if (spin_step < idle_spin_step_amount) {
+				for (Size i = 0; i != Size(1) << spin_step; i++) {
+					cpu_pause();
+				}
+				spin_step++;
+			}
+			else {
+				// Block until there is background work that may be run, or the Scheduler is being destroyed.
+				const bool parked = background_parking_lot->park(index, [this, &worker]() {
+					return state.load(std::memory_order::relaxed) == State::Quit || (may_run_background() && is_background_work_visible(worker));
+				});
+				if (parked) {
+					worker.statistics.add_park();
+				}
+				spin_step = 0;
+			}
+		}
+	}
+
+	void Scheduler::configure_background_thread(Size index) const {
+		if (!config.reserved_processors.empty()) {
+			set_current_thread_affinity(get_available_processors(topology, config.reserved_processors));
+		}
+		if (config.background_thread_priority != ThreadPriority::Normal) {
+			set_current_thread_priority(config.background_thread_priority);
+		}
+		if (!config.thread_name_prefix.empty()) {
+			set_current_thread_name(config.thread_name_prefix + std::to_string(worker_amount + index));
+		}
+	}
+
+	const Job* Scheduler::take_background_job(Worker& worker, bool& stolen) {
+		stolen = false;
+		if (const Job* own_job = worker.pop()) {
+			return own_job;
+		}
+		if (worker.refill_queue()) {
+			return worker.pop();
+		}
+		stolen = true;
+		if (background_shared_queue) {
+			if (const Job* job = background_shared_queue->pop()) {
+				return job;
+			}
+		}
+		if (!background_injection_queue->is_empty()) {
+			// Allocated before popping, as in take_submitted_job().
+			if (Job* job = worker.job_allocator.allocate()) {
+				if (background_injection_queue->pop(*job)) {
+					return job;
+				}
+				worker.job_allocator.job_completed(job);
+			}
+		}
+		// Every background worker is tried once, since an empty lane is the common case and there is no stealer count to wait on.
+		for (Size i = 0; i != background_workers.size(); i++) {
+			const Size victim_index = worker.victim_selector.select();
+			if (const Job* job = background_workers[victim_index]->steal(worker)) {
+				worker.victim_selector.steal_succeeded();
+				return job;
+			}
+			worker.statistics.add_failed_steal_attempt();
+			worker.victim_selector.steal_failed();
+		}
+		return nullptr;
+	}
+
+	void Scheduler::begin_background_work() {
+		Size busy = busy_background_amount.load(std::memory_order::relaxed);
+		for (;;) {
+			if (busy == background_reset_lock) {
 				std::this_thread::yield();
+				busy = busy_background_amount.load(std::memory_order::relaxed);
+			}
+			else if (busy_background_amount.compare_exchange_weak(busy, busy + 1, std::memory_order::seq_cst, std::memory_order::relaxed)) {
+				return;
+			}
+		}
+	}
+
+	void Scheduler::end_background_work() {
+		if (busy_background_amount.fetch_sub(1, std::memory_order::seq_cst) != 1) {
+			return;
+		}
+		// No background worker is touching the Job memory of the lane while the lock is held. If none of it is in use either, i.e. there are
+		// no Jobs left in the lane's queues and no reads of its Jobs in progress, all of it can be reused. Jobs waiting in the injection queue
+		// are not in Job memory.
+		Size expected = 0;
+		if (!busy_background_amount.compare_exchange_strong(expected, background_reset_lock, std::memory_order::seq_cst, std::memory_order::relaxed)) {
+			return;
+		}
+		bool in_use = pending_background_io_amount.load(std::memory_order::seq_cst) != 0 || (background_shared_queue && !background_shared_queue->is_empty());
+		for (const auto& worker : background_workers) {
+			in_use = in_use || worker->has_stealable_jobs() || !worker->overflow_jobs.empty();
+		}
+		if (!in_use) {
+			for (auto& worker : background_workers) {
+				worker->job_queue.reset();
+				worker->job_allocator.reset();
+				worker->scratch_allocator.reset();
+			}
+			background_chunk_allocator->reset(); // JobChunkAllocator::reset(), not unique_ptr::reset().
+			background_run->arena.reset();
+		}
+		busy_background_amount.store(0, std::memory_order::seq_cst);
+	}
+
+	bool Scheduler::may_run_background() const {
+		if (!config.background_yields_to_runs || state.load(std::memory_order::relaxed) != State::Work) {
+			return true;
+		}
+		const Size idle_amount = std::min(stealer_amount.load(std::memory_order::relaxed), active_worker_amount.load(std::memory_order::relaxed));
+		return running_background_amount.load(std::memory_order::relaxed) < idle_amount;
+	}
+
+	bool Scheduler::is_background_work_visible(const Worker& worker) const {
+		if (!worker.overflow_jobs.empty()) {
+			return true;
+		}
+		if (background_shared_queue && !background_shared_queue->is_empty()) {
+			return true;
+		}
+		if (!background_injection_queue->is_empty()) {
+			return true;
+		}
+		for (const auto& other : background_workers) {
+			if (other->has_stealable_jobs()) {
+				return true;
 			}
 		}
+		return false;
 	}
 
 }
\ No newline at end of file
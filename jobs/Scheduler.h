@@ -2,9 +2,20 @@
 
 #include <memory>
 #include <vector>
+#include <span>
 #include <atomic>
-#include <barrier>
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <utility>
+#include <type_traits>
+#include <cassert>
+
+#include "Job.h"
+#include "Barrier.h"
+#include "Topology.h"
+#include "VictimSelector.h"
+#include "Thread.h"
 
 namespace std {
 	class thread;
@@ -12,9 +23,91 @@ namespace std {
 
 namespace jobs {
 
-	struct Job;
+	struct Worker;
 	class JobChunkAllocator;
+	class SharedJobQueue;
+	class InjectionQueue;
+	class IoService;
+	struct IoRequest;
+	class ParkingLot;
 	class JobGraph;
+	class CompiledJobGraph;
+	class JobGraphNode;
+	class JobGraphRun;
+	class JobGraphNodeRun;
+
+	struct SchedulerConfig {
+		// 0 means one worker per logical processor that is not reserved.
+		uint32_t worker_amount = 0;
+		// Chunks of Jobs allocated up front. Raised to at least one chunk per worker.
+		uint32_t allocation_chunk_amount = 32;
+		// More chunks are allocated when needed, up to this amount in total. Chunks are recycled as soon as all of their Jobs are completed,
+		// so this only limits the amount of Jobs in existence at once. Once it's reached, spawned Jobs are run immediately instead.
+		uint32_t max_allocation_chunk_amount = 1024;
+		VictimPolicy victim_policy = VictimPolicy::Random;
+		// Pins every worker to a single logical processor, assigned in order from the processors that are not reserved.
+		bool pin_workers = false;
+		// Logical processors each worker may run on, indexed by worker. Overrides pin_workers for the workers it has a non-empty set for.
+		std::vector<std::vector<uint32_t>> worker_processors;
+		// Logical processors left for other threads, e.g. rendering and audio. Workers without an explicit processor set are kept off them.
+		std::vector<uint32_t> reserved_processors;
+		ThreadPriority thread_priority = ThreadPriority::Normal;
+		// Worker threads are named thread_name_prefix + worker index. No names are set if empty.
+		std::string thread_name_prefix = "Worker ";
+		// Worker 0 is the thread constructing the Scheduler. If set, its affinity, priority and name are changed as well (and not restored).
+		bool configure_calling_thread = false;
+		// Events kept per worker when trace_events is enabled. Has to be a power of 2.
+		uint32_t trace_event_capacity = 1 << 16;
+		// Reads kept in flight by the kernel at once for JobSpawner::spawn_after_read(). 0 disables asynchronous I/O, which saves the thread
+		// waiting for the reads to complete.
+		uint32_t io_queue_depth = 0;
+		// Workers of the background lane, see Scheduler::submit_background(). They are not counted in worker_amount, and are kept off the
+		// reserved processors as well.
+		uint32_t background_worker_amount = 0;
+		ThreadPriority background_thread_priority = ThreadPriority::BelowNormal;
+		// If set, background workers only start a Job while a run is in progress if fewer of them are running Jobs than there are workers
+		// out of work, so that they fill idle processors without competing with the run. Otherwise they only rely on background_thread_priority.
+		bool background_yields_to_runs = true;
+		// Workers taking part in runs at first, see Scheduler::set_active_worker_amount(). 0 means all of them.
+		uint32_t active_worker_amount = 0;
+		// If set, the amount of active workers is adjusted automatically whenever all workers go idle, from the share of time the active
+		// workers spent running Jobs during the last elastic_window_amount such periods: lowered by one below elastic_low_utilization, raised
+		// by one above elastic_high_utilization, staying between min_active_worker_amount and worker_amount. Needs worker_statistics, without
+		// which the time spent running Jobs is not measured, and the setting is ignored.
+		bool elastic_workers = false;
+		uint32_t min_active_worker_amount = 1;
+		uint32_t elastic_window_amount = 16;
+		double elastic_low_utilization = 0.5;
+		double elastic_high_utilization = 0.85;
+	};
+
+	// Refers to a run started by Scheduler::run_async(). Has to be passed to Scheduler::wait() before being destroyed.
+	class RunHandle {
+	public:
+		RunHandle() = default;
+		RunHandle(const RunHandle&) = delete;
+		RunHandle(RunHandle&& other) noexcept : graph_run(std::exchange(other.graph_run, nullptr)) {}
+		RunHandle& operator=(const RunHandle&) = delete;
+		RunHandle& operator=(RunHandle&& other) noexcept;
+		~RunHandle() { assert(!graph_run && "RunHandle destroyed without waiting for the run."); }
+		// True once all Jobs of the run are completed. Can be polled instead of waiting, but the handle still has to be waited for.
+		bool is_done() const;
+		// False for a default-constructed handle, and after the handle has been waited for.
+		bool is_valid() const { return graph_run; }
+
+	private:
+		friend class Scheduler;
+
+		explicit RunHandle(JobGraphRun* graph_run) : graph_run(graph_run) {}
+
+		JobGraphRun* graph_run = nullptr;
+	};
+
+	inline RunHandle& RunHandle::operator=(RunHandle&& other) noexcept {
+		assert(!graph_run && "RunHandle overwritten without waiting for the run.");
+		graph_run = std::exchange(other.graph_run, nullptr);
+		return *this;
+	}
 
 	class Scheduler {
 	public:
@@ -23,19 +116,55 @@ namespace jobs {
 		static_assert(AtomicSize::is_always_lock_free, "Scheduler will work without this, but may not be lock-free. It wants to be lock-free.");
 
 		// Spawns [desired_worker_amount - 1] threads. (The calling thread will be a worker as well)
-		Scheduler(Size desired_worker_amount, Size desired_allocation_chunk_amount);
+		// With VictimPolicy::Topology, worker i is assumed to run on the i-th logical processor (modulo the processor amount).
+		Scheduler(Size desired_worker_amount, Size desired_allocation_chunk_amount, VictimPolicy victim_policy = VictimPolicy::Random);
+		// With VictimPolicy::Topology, pinned workers are assumed to run on the first processor of their set.
+		Scheduler(const SchedulerConfig& config);
 		~Scheduler();
 		// Sets the dependency graph to be run. Can be changed between calls to run().
 		void set_job_graph(const JobGraph* graph);
+		void set_job_graph(const CompiledJobGraph* graph);
 		// Runs the currently set dependency graph. Blocks until all Jobs are completed (The calling thread participates in the work as well).
 		void run();
+		// Starts running given graph and returns without waiting. Several runs, of the same graph or of different ones, can be in progress at once,
+		// each with its own node state, e.g. to start the next frame before the previous one has completed. The graph must not be modified or
+		// destroyed before the run is done. The calling thread only participates in the work while waiting, so with a single worker, nothing is
+		// run before wait(). The same goes for root Jobs kept by QueueOverflowPolicy::WorkerList, when they don't fit into the queue of the calling
+		// thread's worker. Like run() and wait(), may only be called from the thread that constructed the Scheduler.
+		RunHandle run_async(const JobGraph* graph);
+		RunHandle run_async(const CompiledJobGraph* graph);
+		// Blocks until the run referred to by given handle is completed, participating in the work meanwhile. Invalidates the handle.
+		// If no other runs are in progress, also waits for all workers to go idle, after which the memory used by Jobs is reused.
+		void wait(RunHandle& handle);
+		// Submits a free Job from any thread, including threads that are not workers of this Scheduler, e.g. for network or file callbacks.
+		// Workers take submitted Jobs before stealing from each other, while any run is in progress; Jobs submitted while no run is in progress
+		// wait for the next one. The Jobs don't belong to any run, so runs are not kept from completing by them, but the workers don't go idle
+		// while they are running. Jobs spawned by a submitted Job are free Jobs as well. Returns false if injection_queue_capacity Jobs are
+		// already waiting for a worker.
+		template<typename Params>
+		bool submit(JobFunction* function, const Params& params);
+		// Submits a free Job from any thread to the background lane: background workers with queues and stealing of their own, which keep
+		// running whether runs are in progress or not, e.g. for streaming or long computations spanning several frames. Jobs spawned by a
+		// background Job stay in the lane as well. Background workers have worker indices from get_worker_amount() onward, so Reductions
+		// sized by get_worker_amount() can't be used from them. Returns false if injection_queue_capacity Jobs are already waiting.
+		// Destroying the Scheduler waits for the background Jobs being run, but drops the ones still waiting.
+		template<typename Params>
+		bool submit_background(JobFunction* function, const Params& params);
+		// Sets the amount of workers taking part in runs, clamped to [1, get_worker_amount()]. Workers 0 to amount - 1 are the active ones;
+		// the others keep their threads but stay blocked, and are not woken up by runs. May only be called while no runs are in progress,
+		// from the thread that constructed the Scheduler. Also adjusted automatically with SchedulerConfig::elastic_workers.
+		void set_active_worker_amount(Size amount);
+		Size get_active_worker_amount() const { return active_worker_amount.load(std::memory_order::relaxed); }
 		void write_statistics(std::ostream& out_stream) const;
 		void reset_statistics();
+		// Writes the events recorded with trace_events in the Chrome Trace Event format (see write_chrome_trace()). Like write_statistics(),
+		// should only be called while no runs are in progress. Node names are not copied, so the graphs should still exist.
+		void write_trace(std::ostream& out_stream) const;
+		void reset_trace();
 		Size get_worker_amount() const { return worker_amount; }
+		Size get_background_worker_amount() const { return static_cast<Size>(background_workers.size()); }
 
 	private:
-		struct Worker;
-
 		enum class State : Size {
 			Wait,
 			Work,
@@ -44,23 +173,150 @@ namespace jobs {
 		using AtomicState = std::atomic<State>;
 		static_assert(AtomicState::is_always_lock_free, "Scheduler will work without this, but may not be lock-free. It wants to be lock-free.");
 
+		friend class JobGraphRun;
+		friend class JobGraphNodeRun;
+		friend class JobSpawner;
+		friend class IoService;
+
 		void thread_loop(Size worker_index);
+		void configure_thread(Size worker_index) const;
 		void create_worker(Size index);
+		bool submit_impl(JobFunction* function, const void* params, size_t params_size);
+		bool submit_background_impl(JobFunction* function, const void* params, size_t params_size);
+		// Returns a copy of the oldest submitted Job, allocated by the worker, or null if there are none or the worker is out of Job memory.
+		Job* take_submitted_job(Worker& worker);
+		// Called by JobSpawner::spawn_after_read(), and by IoService when the read is done, from its own thread.
+		void start_read(IoRequest& request);
+		void io_completed(IoRequest& request);
+		// Called by the continuation of a read before running it, once it's done with the request.
+		void io_continuation_started(const JobGraphRun& graph_run);
+		// Reads of background Jobs are counted, and their continuations run, in the background lane.
+		bool is_background_run(const JobGraphRun* graph_run) const { return graph_run == background_run.get(); }
+		JobGraphRun& acquire_graph_run();
+		RunHandle start_run(JobGraphRun& graph_run);
+		// With frame_coherent_placement: Pushes the enabled root Jobs of the run to the workers, longest first, each to the least loaded one.
+		void place_root_jobs(JobGraphRun& graph_run);
+		// Pushes job to the queue of given worker, waking it up. Called by current, which pushes to its own queue if the other one is full.
+		void place_job(Job* job, Size worker_index, bool is_priority, Worker& current);
+		// Called by JobGraphRun when all of its Jobs are completed.
+		void run_completed(JobGraphRun& graph_run);
+		// Makes the calling thread work as worker 0 until given run is done. If graph_run is null, or no other runs are in progress, until all workers are idle.
+		void participate(const JobGraphRun* graph_run);
 		void run_worker(Size index);
-		void work_loop(Worker& worker);
+		// Resets the worker once all workers are idle. Called by every worker at the same time.
+		void finish_work(Worker& worker);
+		// Returns true when all workers are out of work, false if stopped early because should_stop() returned true.
+		template<typename StopCondition>
+		bool work_loop(Worker& worker, StopCondition should_stop);
+		// Called after a failed steal attempt, while not all workers are stealing. spin_step counts the consecutive calls.
+		template<typename StopCondition>
+		void idle(Worker& worker, Size& spin_step, StopCondition should_stop);
+		// True if SchedulerConfig::elastic_workers is set and can be followed.
+		bool is_elastic() const { return worker_statistics && config.elastic_workers; }
+		// With elastic_workers: Called by worker 0 whenever all workers have gone idle.
+		void adjust_active_worker_amount();
+		// True when all active workers are stealing with no reads in progress, i.e. when it's time to check whether all work is done.
+		bool is_work_done_visible() const;
+		bool is_stealable_work_visible() const;
+		// Victims among the first active_amount workers.
+		std::vector<std::vector<Size>> get_victim_tiers(Size worker_index, Size active_amount) const;
+		void background_thread_loop(Size index);
+		void configure_background_thread(Size index) const;
+		// Returns the next Job for a background worker: from its own queue, from the shared background queues, or stolen from another
+		// background worker. stolen is set to false for Jobs from the own queue.
+		const Job* take_background_job(Worker& worker, bool& stolen);
+		// Called by background workers before and after looking for Jobs. The last one to stop resets the Job memory of the lane.
+		void begin_background_work();
+		void end_background_work();
+		// False while background workers should leave the processors to a run in progress.
+		bool may_run_background() const;
+		// Overflowed Jobs are only visible to their own worker.
+		bool is_background_work_visible(const Worker& worker) const;
 
+		SchedulerConfig config;
+		// Only detected if needed by the config. Declared before worker_amount, which may depend on it.
+		ProcessorTopology topology;
 		Size worker_amount;
+		// Logical processors each worker is restricted to, empty for no restriction.
+		std::vector<std::vector<uint32_t>> worker_processors;
+		// Logical processor each worker is assumed to run on, used for VictimPolicy::Topology.
+		std::vector<const ProcessorTopology::Processor*> worker_home_processors;
 		std::vector<std::unique_ptr<Worker>> workers;
 		std::vector<std::thread> threads;
 		std::unique_ptr<JobChunkAllocator> chunk_allocator;
+		// Only created with QueueOverflowPolicy::SharedQueue.
+		std::unique_ptr<SharedJobQueue> shared_queue;
+		// Only created with IdlePolicy::SpinThenPark.
+		std::unique_ptr<ParkingLot> parking_lot;
+		std::unique_ptr<InjectionQueue> injection_queue;
+		// The run that submitted Jobs, and the Jobs spawned by them, belong to. Does not track completion.
+		std::unique_ptr<JobGraphRun> submitted_run;
+		// Only created with a non-zero io_queue_depth. Declared after the queues its thread pushes to, so that it's destroyed first.
+		std::unique_ptr<IoService> io_service;
+		// One of these is set at a time.
 		const JobGraph* job_graph = nullptr;
-		// Barrier to sync all workers at the beginning and end of a single run.
-		std::barrier<> sync_point;
+		const CompiledJobGraph* compiled_job_graph = nullptr;
+		// State of every run started so far. Runs that have been waited for are reused by later runs.
+		std::vector<std::unique_ptr<JobGraphRun>> graph_runs;
+		std::vector<JobGraphRun*> free_graph_runs;
+		// Used by place_root_jobs(), kept to avoid allocating for every run.
+		std::vector<JobGraphNodeRun*> placed_root_nodes;
+		std::vector<int64_t> worker_loads;
+		AtomicSize runs_in_flight = 0;
+		// Barrier to sync all workers once they are created, and the active ones when they run out of work with no runs in progress, so that
+		// they can be reset.
+		Barrier sync_point;
 		AtomicState state = State::Wait;
-		// Number of workers that are currently stealing. (When all workers are stealing, it means there is no more work to do)
+		// Workers taking part in runs. Only changed while no runs are in progress; inactive workers wait for it to change.
+		AtomicSize active_worker_amount;
+		// Incremented whenever the active workers waiting for a run need to look at the state and the active amount again, i.e. when a run
+		// is started, when the Scheduler is destroyed and when the active amount is lowered.
+		AtomicSize wake_generation = 0;
+		// Number of active workers that are currently stealing. (When all of them are stealing, it means there is no more work to do)
 		AtomicSize stealer_amount;
-		// Number of workers that are working or stealing. Used as a double-check to make sure all workers agree on whether all work is done.
+		// Number of active workers that are working or stealing. Used as a double-check to make sure all workers agree on whether all work is done.
 		AtomicSize active_amount;
+		// Used by adjust_active_worker_amount(): the idle periods measured so far, the time spent working on runs during them, when the
+		// current one started, and the work duration of each worker when the measurement started.
+		Size elastic_period_amount = 0;
+		std::chrono::nanoseconds elastic_run_duration = std::chrono::nanoseconds::zero();
+		std::chrono::steady_clock::time_point run_start_time;
+		std::vector<std::chrono::nanoseconds> elastic_work_durations;
+		// Reads whose continuation has not started running yet, not counting reads of background Jobs. While there are any, workers out of
+		// work wait for them instead of going idle.
+		AtomicSize pending_io_amount = 0;
+		// The background lane, all empty or null with a background_worker_amount of 0. Its Job memory is not reset with the rest, since
+		// background Jobs span runs. It's reset whenever all background workers are out of work instead.
+		std::vector<std::unique_ptr<Worker>> background_workers;
+		std::vector<std::thread> background_threads;
+		std::unique_ptr<JobChunkAllocator> background_chunk_allocator;
+		std::unique_ptr<SharedJobQueue> background_shared_queue;
+		std::unique_ptr<ParkingLot> background_parking_lot;
+		std::unique_ptr<InjectionQueue> background_injection_queue;
+		std::unique_ptr<JobGraphRun> background_run;
+		// Background workers that have been created, which all of them wait for before stealing from each other.
+		AtomicSize created_background_amount = 0;
+		// Background workers currently running a Job, compared to stealer_amount by may_run_background().
+		AtomicSize running_background_amount = 0;
+		// Like pending_io_amount, for reads of background Jobs. While there are any, the Job memory of the lane is not reset.
+		AtomicSize pending_background_io_amount = 0;
+		// Background workers looking for or running Jobs, or background_reset_lock while the lane is being reset.
+		AtomicSize busy_background_amount = 0;
+		static constexpr Size background_reset_lock = ~Size(0);
 	};
 
+	template<typename Params>
+	inline bool Scheduler::submit(JobFunction* function, const Params& params) {
+		static_assert(sizeof(Params) <= param_buffer_size, "Params has to fit into Job::param_buffer. Data that does not fit needs to be allocated elsewhere and pointed to in Params.");
+		static_assert(std::is_trivially_copyable_v<Params>, "Params has to be a trivially copyable type. The data is memcpy'd into Job::param_buffer.");
+		return submit_impl(function, &params, sizeof(Params));
+	}
+
+	template<typename Params>
+	inline bool Scheduler::submit_background(JobFunction* function, const Params& params) {
+		static_assert(sizeof(Params) <= param_buffer_size, "Params has to fit into Job::param_buffer. Data that does not fit needs to be allocated elsewhere and pointed to in Params.");
+		static_assert(std::is_trivially_copyable_v<Params>, "Params has to be a trivially copyable type. The data is memcpy'd into Job::param_buffer.");
+		return submit_background_impl(function, &params, sizeof(Params));
+	}
+
 }
\ No newline at end of file
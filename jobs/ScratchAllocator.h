@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+namespace jobs {
+
+	// Linear allocator for data that is too large to pass in Job::param_buffer. Each worker has one, don't share between threads.
+	// Memory is allocated from a list of blocks, which is grown when needed and kept over reset(), so once the list has grown to its working size,
+	// allocating is just bumping an offset. Individual allocations are never freed, and no destructors are run.
+	class ScratchAllocator {
+	public:
+		ScratchAllocator(size_t block_size) : block_size(block_size) {}
+		ScratchAllocator(const ScratchAllocator&) = delete;
+		ScratchAllocator(ScratchAllocator&&) = delete;
+		ScratchAllocator& operator=(const ScratchAllocator&) = delete;
+		ScratchAllocator& operator=(ScratchAllocator&&) = delete;
+		// Allocations larger than the block size get a block of their own.
+		void* allocate(size_t size, size_t alignment);
+		// Makes all allocated memory reusable.
+		void reset();
+
+	private:
+		struct Block {
+			std::unique_ptr<uint8_t[]> data;
+			size_t size;
+		};
+
+		const size_t block_size;
+		std::vector<Block> blocks;
+		size_t block_index = 0;
+		size_t used = 0;
+	};
+
+	inline void* ScratchAllocator::allocate(size_t size, size_t alignment) {
+		assert((alignment & (alignment - 1)) == 0);
+		for (;;) {
+			if (block_index == blocks.size()) {
+				const size_t new_block_size = std::max(block_size, size + alignment - 1);
+				blocks.push_back({ std::make_unique_for_overwrite<uint8_t[]>(new_block_size), new_block_size });
+				used = 0;
+			}
+			Block& block = blocks[block_index];
+			const uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+			const size_t offset = ((base + used + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base;
+			if (offset + size <= block.size) {
+				used = offset + size;
+				return block.data.get() + offset;
+			}
+			block_index++;
+			used = 0;
+		}
+	}
+
+	inline void ScratchAllocator::reset() {
+		block_index = 0;
+		used = 0;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+
+namespace jobs {
+
+	// Lock-free linear allocator shared by all workers. Memory is allocated from fixed-size blocks, which are kept in a list and reused
+	// after reset(), so allocating only needs a fetch_add once the arena has grown to its working size. Individual allocations are never freed,
+	// and no destructors are run, so only trivially destructible objects should be placed in it.
+	class SharedArena {
+	public:
+		// A single allocation, including alignment padding, needs to fit into one block.
+		SharedArena(size_t block_size) : block_size(block_size) {}
+		SharedArena(const SharedArena&) = delete;
+		SharedArena(SharedArena&&) = delete;
+		SharedArena& operator=(const SharedArena&) = delete;
+		SharedArena& operator=(SharedArena&&) = delete;
+		~SharedArena();
+		// Thread-safe.
+		void* allocate(size_t size, size_t alignment);
+		// Makes all allocated memory reusable. Not thread-safe: No other thread may be using the arena.
+		void reset();
+
+	private:
+		struct Block {
+			std::atomic<Block*> next = nullptr;
+			std::atomic<size_t> used = 0;
+		};
+
+		// Block header and data are allocated together.
+		static constexpr size_t header_size = (sizeof(Block) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+		Block* new_block() const;
+		uint8_t* get_data(Block* block) const { return reinterpret_cast<uint8_t*>(block) + header_size; }
+
+		const size_t block_size;
+		Block* first_block = nullptr;
+		std::atomic<Block*> current_block = nullptr;
+	};
+
+	inline SharedArena::~SharedArena() {
+		for (Block* block = first_block; block;) {
+			Block* next = block->next.load(std::memory_order::relaxed);
+			block->~Block();
+			::operator delete(block);
+			block = next;
+		}
+	}
+
+	inline SharedArena::Block* SharedArena::new_block() const {
+		return new (::operator new(header_size + block_size)) Block();
+	}
+
+	inline void* SharedArena::allocate(size_t size, size_t alignment) {
+		assert(size + alignment - 1 <= block_size && (alignment & (alignment - 1)) == 0);
+		Block* block = current_block.load(std::memory_order::acquire);
+		if (!block) {
+			// First allocation ever. Racing threads agree on a single first block.
+			Block* created_block = new_block();
+			if (current_block.compare_exchange_strong(block, created_block, std::memory_order::acq_rel, std::memory_order::acquire)) {
+				first_block = created_block;
+				block = created_block;
+			}
+			else {
+				created_block->~Block();
+				::operator delete(created_block);
+			}
+		}
+		for (;;) {
+			const size_t offset = block->used.fetch_add(size + alignment - 1, std::memory_order::relaxed);
+			if (offset + size + alignment - 1 <= block_size) {
+				const uintptr_t address = reinterpret_cast<uintptr_t>(get_data(block) + offset);
+				return reinterpret_cast<void*>((address + alignment - 1) & ~(uintptr_t(alignment) - 1));
+			}
+			// The block is full. Move on to the next one, creating it if this is the last one.
+			Block* next = block->next.load(std::memory_order::acquire);
+			if (!next) {
+				Block* created_block = new_block();
+				if (block->next.compare_exchange_strong(next, created_block, std::memory_order::acq_rel, std::memory_order::acquire)) {
+					next = created_block;
+				}
+				else {
+					created_block->~Block();
+					::operator delete(created_block);
+				}
+			}
+			// Failing means another thread has already moved on.
+			current_block.compare_exchange_strong(block, next, std::memory_order::acq_rel, std::memory_order::acquire);
+			block = current_block.load(std::memory_order::acquire);
+		}
+	}
+
+	inline void SharedArena::reset() {
+		for (Block* block = first_block; block; block = block->next.load(std::memory_order::relaxed)) {
+			block->used.store(0, std::memory_order::relaxed);
+		}
+		current_block.store(first_block, std::memory_order::relaxed);
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <cassert>
+
+#include "Config.h"
+
+namespace jobs {
+
+	struct Job;
+
+	// Fixed-capacity multi-producer multi-consumer queue of Jobs, shared by multiple workers. Based on the bounded MPMC queue by Dmitry Vyukov:
+	// Every cell has a sequence number telling whether it's ready to be written or read at a given position, so producers and consumers
+	// only contend on a single CAS each. Slower than JobQueue, so only used where any thread needs to be able to push.
+	class SharedJobQueue {
+	public:
+		using Size = size_t;
+		using Difference = std::make_signed_t<Size>;
+		using AtomicSize = std::atomic<Size>;
+		static_assert(AtomicSize::is_always_lock_free, "SharedJobQueue will work without this, but may not be lock-free. It wants to be lock-free.");
+
+		// Capacity has to be a power of 2.
+		SharedJobQueue(Size capacity);
+		SharedJobQueue(const SharedJobQueue&) = delete;
+		SharedJobQueue(SharedJobQueue&&) = delete;
+		SharedJobQueue& operator=(const SharedJobQueue&) = delete;
+		SharedJobQueue& operator=(SharedJobQueue&&) = delete;
+		// Returns false if the queue is full.
+		bool push(Job* job);
+		// Returns null if the queue is empty.
+		Job* pop();
+		// Only a hint, since other threads may push or pop at any moment.
+		bool is_empty() const;
+
+	private:
+		struct Cell {
+			AtomicSize sequence;
+			Job* job;
+		};
+
+		const Size capacity;
+		std::unique_ptr<Cell[]> cells;
+		alignas(cacheline_size) AtomicSize push_position = 0;
+		alignas(cacheline_size) AtomicSize pop_position = 0;
+	};
+
+	inline SharedJobQueue::SharedJobQueue(Size capacity) : capacity(capacity), cells(new Cell[capacity]) {
+		assert(capacity > 1 && (capacity & (capacity - 1)) == 0);
+		for (Size i = 0; i != capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order::relaxed);
+			cells[i].job = nullptr;
+		}
+	}
+
+	inline bool SharedJobQueue::push(Job* job) {
+		Size position = push_position.load(std::memory_order::relaxed);
+		for (;;) {
+			Cell& cell = cells[position & (capacity - 1)];
+			const Size sequence = cell.sequence.load(std::memory_order::acquire);
+			const Difference difference = static_cast<Difference>(sequence - position);
+			if (difference == 0) {
+				if (push_position.compare_exchange_weak(position, position + 1, std::memory_order::relaxed, std::memory_order::relaxed)) {
+					cell.job = job;
+					cell.sequence.store(position + 1, std::memory_order::release);
+					return true;
+				}
+			}
+			else if (difference < 0) {
+				return false;
+			}
+			else {
+				position = push_position.load(std::memory_order::relaxed);
+			}
+		}
+	}
+
+	inline bool SharedJobQueue::is_empty() const {
+		return pop_position.load(std::memory_order::relaxed) == push_position.load(std::memory_order::relaxed);
+	}
+
+	inline Job* SharedJobQueue::pop() {
+		Size position = pop_position.load(std::memory_order::relaxed);
+		for (;;) {
+			Cell& cell = cells[position & (capacity - 1)];
+			const Size sequence = cell.sequence.load(std::memory_order::acquire);
+			const Difference difference = static_cast<Difference>(sequence - (position + 1));
+			if (difference == 0) {
+				if (pop_position.compare_exchange_weak(position, position + 1, std::memory_order::relaxed, std::memory_order::relaxed)) {
+					Job* job = cell.job;
+					cell.sequence.store(position + capacity, std::memory_order::release);
+					return job;
+				}
+			}
+			else if (difference < 0) {
+				return nullptr;
+			}
+			else {
+				position = pop_position.load(std::memory_order::relaxed);
+			}
+		}
+	}
+
+}
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <chrono>
 #include <iostream>
 
+#include "Config.h"
+#include "PerfCounters.h"
+
 namespace jobs {
 
 	class Timer {
@@ -14,6 +17,31 @@ namespace jobs {
 		const std::chrono::steady_clock::time_point start_time;
 	};
 
+	// Timer for WorkerStatistics. Does not read the clock when worker_statistics is disabled.
+	class StatisticsTimer {
+	public:
+		StatisticsTimer();
+		std::chrono::nanoseconds get_elapsed() const;
+
+	private:
+		std::chrono::steady_clock::time_point start_time;
+	};
+
+	inline StatisticsTimer::StatisticsTimer() {
+		if constexpr (worker_statistics) {
+			start_time = std::chrono::steady_clock::now();
+		}
+	}
+
+	inline std::chrono::nanoseconds StatisticsTimer::get_elapsed() const {
+		if constexpr (worker_statistics) {
+			return std::chrono::steady_clock::now() - start_time;
+		}
+		else {
+			return std::chrono::nanoseconds::zero();
+		}
+	}
+
 	// Passed to Job functions to provide logging/debugging information. See also UserJobLogger below.
 	class WorkerInfo {
 	public:
@@ -39,51 +67,102 @@ namespace jobs {
 		UserJobLogger& operator=(const UserJobLogger&) = delete;
 		UserJobLogger& operator=(UserJobLogger&&) = delete;
 		~UserJobLogger() {
-			worker_info.user_job_amount++;
-			worker_info.user_job_duration += timer.get_elapsed();
+			if constexpr (worker_statistics) {
+				worker_info.user_job_amount++;
+				worker_info.user_job_duration += timer.get_elapsed();
+			}
 		}
 
 	private:
 		WorkerInfo& worker_info;
-		const Timer timer;
+		const StatisticsTimer timer;
 	};
 
 	// Contains statistics for a single worker. These get written to a stream by Scheduler::write_statistics().
 	class WorkerStatistics {
 	public:
 		WorkerStatistics(uint32_t index) : info(index) {}
-		void add_own_job() { own_job_amount++; }
-		void add_stolen_job() { stolen_job_amount++; }
-		void add_failed_steal_attempt() { failed_steal_amount++; }
-		void add_false_wait() { false_wait_amount++; }
-		void add_total_timing(const Timer& timer) { total_duration += timer.get_elapsed(); }
-		void add_work_timing(const Timer& timer) { work_duration += timer.get_elapsed(); }
+		void add_own_job() { if constexpr (worker_statistics) { own_job_amount++; } }
+		void add_stolen_job() { if constexpr (worker_statistics) { stolen_job_amount++; } }
+		void add_failed_steal_attempt() { if constexpr (worker_statistics) { failed_steal_amount++; } }
+		void add_false_wait() { if constexpr (worker_statistics) { false_wait_amount++; } }
+		void add_queue_overflow() { if constexpr (worker_statistics) { queue_overflow_amount++; } }
+		void add_park() { if constexpr (worker_statistics) { park_amount++; } }
+		void add_allocation_failure() { if constexpr (worker_statistics) { allocation_failure_amount++; } }
+		void add_total_timing(const StatisticsTimer& timer) { if constexpr (worker_statistics) { total_duration += timer.get_elapsed(); } }
+		void add_work_timing(const StatisticsTimer& timer) { if constexpr (worker_statistics) { work_duration += timer.get_elapsed(); } }
+		// Time spent running Jobs since the last reset. Always zero without worker_statistics.
+		std::chrono::nanoseconds get_work_duration() const { return work_duration; }
+		// Used with perf_counters.
+		void set_available_perf_counters(uint32_t mask) { available_perf_counters = mask; }
+		void add_total_counters(const PerfCounterValues& values) { if constexpr (perf_counters) { total_counters += values; } }
+		void add_own_job_counters(const PerfCounterValues& values) { if constexpr (perf_counters) { own_job_counters += values; } }
+		void add_stolen_job_counters(const PerfCounterValues& values) { if constexpr (perf_counters) { stolen_job_counters += values; } }
 		void write(std::ostream& out_stream) const;
 		void reset();
 
 		WorkerInfo info;
 
 	private:
+		void write_counters(std::ostream& out_stream, const char* label, const PerfCounterValues& values) const;
+
 		uint32_t own_job_amount = 0;
 		uint32_t stolen_job_amount = 0;
 		uint64_t failed_steal_amount = 0;
 		uint64_t false_wait_amount = 0;
+		uint64_t queue_overflow_amount = 0;
+		uint64_t park_amount = 0;
+		uint64_t allocation_failure_amount = 0;
 		std::chrono::nanoseconds total_duration = std::chrono::nanoseconds::zero();
 		std::chrono::nanoseconds work_duration = std::chrono::nanoseconds::zero();
+		uint32_t available_perf_counters = 0;
+		PerfCounterValues total_counters;
+		PerfCounterValues own_job_counters;
+		PerfCounterValues stolen_job_counters;
 	};
 
 	inline void WorkerStatistics::write(std::ostream& out_stream) const {
 		const uint32_t total_job_amount = own_job_amount + stolen_job_amount;
 		const uint32_t admin_job_amount = total_job_amount - info.user_job_amount;
 		out_stream << "Worker " << info.worker_index << "\n";
+		if constexpr (!worker_statistics) {
+			out_stream << "\tStatistics are disabled (see worker_statistics in Config.h)\n";
+			return;
+		}
 		out_stream << "\tExecuted " << total_job_amount << " jobs\n";
 		out_stream << "\t\t* " << own_job_amount << " own, " << stolen_job_amount << " stolen\n";
 		out_stream << "\t\t* " << info.user_job_amount << " user jobs, " << admin_job_amount << " admin jobs\n";
 		out_stream << "\tFailed to steal " << failed_steal_amount << " times\n";
 		out_stream << "\tFalsely waited " << false_wait_amount << " times (due to incorrectly seeing all workers being done)\n";
+		out_stream << "\tOverflowed own queue " << queue_overflow_amount << " times\n";
+		out_stream << "\tParked " << park_amount << " times while out of work\n";
+		out_stream << "\tRan " << allocation_failure_amount << " jobs immediately due to running out of job memory\n";
 		out_stream << "\tSpent " << std::chrono::duration<double, std::milli>(total_duration).count() << " ms in total,\n";
 		out_stream << "\tof which " << std::chrono::duration<double, std::milli>(work_duration).count() << " ms working,\n";
 		out_stream << "\tof which " << std::chrono::duration<double, std::milli>(info.user_job_duration).count() << " ms on user jobs\n";
+		if constexpr (perf_counters) {
+			write_counters(out_stream, "in total", total_counters);
+			write_counters(out_stream, "running own jobs", own_job_counters);
+			write_counters(out_stream, "running stolen jobs", stolen_job_counters);
+		}
+	}
+
+	inline void WorkerStatistics::write_counters(std::ostream& out_stream, const char* label, const PerfCounterValues& values) const {
+		const auto write_counter = [&](PerfCounter counter, const char* name) {
+			out_stream << " ";
+			if (available_perf_counters & (1u << static_cast<uint32_t>(counter))) {
+				out_stream << values[counter];
+			}
+			else {
+				out_stream << "n/a";
+			}
+			out_stream << " " << name;
+		};
+		out_stream << "\tCounters " << label << ":";
+		write_counter(PerfCounter::Cycles, "cycles,");
+		write_counter(PerfCounter::Instructions, "instructions,");
+		write_counter(PerfCounter::CacheMisses, "LLC misses,");
+		write_counter(PerfCounter::ContextSwitches, "context switches\n");
 	}
 
 	inline void WorkerStatistics::reset() {
@@ -91,8 +170,14 @@ namespace jobs {
 		stolen_job_amount = 0;
 		failed_steal_amount = 0;
 		false_wait_amount = 0;
+		queue_overflow_amount = 0;
+		park_amount = 0;
+		allocation_failure_amount = 0;
 		total_duration = std::chrono::nanoseconds::zero();
 		work_duration = std::chrono::nanoseconds::zero();
+		total_counters = {};
+		own_job_counters = {};
+		stolen_job_counters = {};
 		info.user_job_amount = 0;
 		info.user_job_duration = std::chrono::nanoseconds::zero();
 	}
@@ -0,0 +1,72 @@
+#include "Task.h"
+
+#include <vector>
+#include <new>
+
+namespace jobs {
+
+	namespace {
+
+		constexpr size_t frame_size_class_amount = (max_pooled_task_frame_size + task_frame_granularity - 1) / task_frame_granularity;
+
+		// Frames of each size class freed on the owning thread, kept until the thread exits.
+		struct FramePool {
+			FramePool() = default;
+			FramePool(const FramePool&) = delete;
+			FramePool& operator=(const FramePool&) = delete;
+			~FramePool() {
+				for (size_t i = 0; i != frame_size_class_amount; i++) {
+					for (void* frame : free_frames[i]) {
+						::operator delete(frame, (i + 1) * task_frame_granularity);
+					}
+				}
+			}
+
+			std::vector<void*> free_frames[frame_size_class_amount];
+		};
+
+		thread_local FramePool frame_pool;
+
+		size_t get_size_class(size_t size) {
+			return (size + task_frame_granularity - 1) / task_frame_granularity - 1;
+		}
+
+	}
+
+	void* TaskFrameAllocator::allocate(size_t size) {
+		if (size > max_pooled_task_frame_size) {
+			return ::operator new(size);
+		}
+		const size_t size_class = get_size_class(size);
+		std::vector<void*>& free_frames = frame_pool.free_frames[size_class];
+		if (free_frames.empty()) {
+			return ::operator new((size_class + 1) * task_frame_granularity);
+		}
+		void* frame = free_frames.back();
+		free_frames.pop_back();
+		return frame;
+	}
+
+	void TaskFrameAllocator::deallocate(void* frame, size_t size) {
+		if (size > max_pooled_task_frame_size) {
+			::operator delete(frame, size);
+			return;
+		}
+		frame_pool.free_frames[get_size_class(size)].push_back(frame);
+	}
+
+	void spawn_task(const JobSpawner& job_spawner, Task<void>&& task, bool is_sub_job) {
+		assert(task.handle && !task.handle.done());
+		const std::coroutine_handle<> handle = std::exchange(task.handle, nullptr);
+		TaskPromiseBase* promise = std::exchange(task.promise, nullptr);
+		job_spawner.spawn(resume_task, TaskResumeParams{ handle, promise }, is_sub_job);
+	}
+
+	void resume_task(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info) {
+		const TaskResumeParams& params = *static_cast<const TaskResumeParams*>(param_buffer);
+		params.promise->job_spawner = &job_spawner;
+		params.promise->worker_info = &worker_info;
+		params.handle.resume();
+	}
+
+}
\ No newline at end of file
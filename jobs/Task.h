@@ -0,0 +1,286 @@
+#pragma once
+
+#include <coroutine>
+#include <atomic>
+#include <array>
+#include <span>
+#include <optional>
+#include <utility>
+#include <exception>
+#include <type_traits>
+#include <cassert>
+
+#include "Config.h"
+#include "JobSpawner.h"
+
+namespace jobs {
+
+	class WorkerInfo;
+	template<typename T = void>
+	class Task;
+
+	// Recycles coroutine frames of Tasks through free lists of the calling thread, one per size class. A frame freed on another thread than
+	// it was allocated on simply moves to the free list of that thread, so no synchronization is needed. Frames larger than
+	// max_pooled_task_frame_size come from the heap.
+	class TaskFrameAllocator {
+	public:
+		static void* allocate(size_t size);
+		static void deallocate(void* frame, size_t size);
+	};
+
+	// Where a Task runs, valid until the Task is suspended again. See get_task_context().
+	struct TaskContext {
+		const JobSpawner& job_spawner;
+		WorkerInfo& worker_info;
+	};
+
+	// Used internally by Task, the common part of the promises of all Tasks.
+	class TaskPromiseBase {
+	public:
+		void* operator new(size_t size) { return TaskFrameAllocator::allocate(size); }
+		void operator delete(void* frame, size_t size) { TaskFrameAllocator::deallocate(frame, size); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept;
+		// Jobs have no way to pass exceptions on.
+		void unhandled_exception() noexcept { std::terminate(); }
+
+	private:
+		friend class TaskBase;
+		template<typename Tasks>
+		friend class WhenAllAwaiter;
+		friend struct TaskContextAwaiter;
+		friend void resume_task(const void*, const JobSpawner&, WorkerInfo&);
+
+		// Set every time the coroutine is resumed.
+		const JobSpawner* job_spawner = nullptr;
+		WorkerInfo* worker_info = nullptr;
+		// The awaiting coroutine, resumed by the last of the Tasks it awaits. Null for Tasks started with spawn_task().
+		std::coroutine_handle<> continuation;
+		TaskPromiseBase* continuation_promise = nullptr;
+		// Tasks the awaiting coroutine is still waiting for.
+		std::atomic<uint32_t>* remaining = nullptr;
+	};
+
+	// Used internally by Task, the part of Task that does not depend on the result type.
+	class TaskBase {
+	public:
+		TaskBase(const TaskBase&) = delete;
+		TaskBase& operator=(const TaskBase&) = delete;
+		TaskBase& operator=(TaskBase&&) = delete;
+		// True once the coroutine has returned. Only meaningful to the awaiting coroutine, after the co_await.
+		bool is_done() const { return handle && handle.done(); }
+
+	protected:
+		friend void spawn_task(const JobSpawner& job_spawner, Task<void>&& task, bool is_sub_job);
+		template<typename Tasks>
+		friend class WhenAllAwaiter;
+
+		TaskBase(std::coroutine_handle<> handle, TaskPromiseBase& promise) : handle(handle), promise(&promise) {}
+		TaskBase(TaskBase&& other) noexcept : handle(std::exchange(other.handle, nullptr)), promise(std::exchange(other.promise, nullptr)) {}
+		~TaskBase() {
+			if (handle) {
+				handle.destroy();
+			}
+		}
+
+		std::coroutine_handle<> handle;
+		TaskPromiseBase* promise;
+	};
+
+	// Coroutine running on the workers of a Scheduler. A Task is started only when awaited, with co_await from another Task, or with when_all()
+	// to run several of them in parallel, or from a Job with spawn_task(). The awaiting coroutine is suspended without blocking the worker,
+	// and resumed on the worker completing the last of the awaited Tasks, where their results are likely still in cache.
+	// While a Task is in progress, it keeps the node or run of the Job that started it from completing, the same way as a sub-Job or a free Job.
+	// Tasks are not dropped when their run or node is cancelled (see JobSpawner::cancel_run()), as their frames would never be freed.
+	template<typename T>
+	class Task : public TaskBase {
+	public:
+		class promise_type;
+
+		Task(Task&& other) noexcept = default;
+		// Returns the result. Only valid once the Task is done, i.e. after awaiting it with when_all().
+		std::add_lvalue_reference_t<T> get_result();
+		// Runs the Task, alone, and returns its result.
+		auto operator co_await() &&;
+		auto operator co_await() &;
+
+	private:
+		explicit Task(std::coroutine_handle<promise_type> handle) : TaskBase(handle, handle.promise()) {}
+	};
+
+	template<typename T>
+	class Task<T>::promise_type : public TaskPromiseBase {
+	public:
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		template<typename U>
+		void return_value(U&& value) { result.emplace(std::forward<U>(value)); }
+
+	private:
+		friend class Task;
+
+		std::optional<T> result;
+	};
+
+	template<>
+	class Task<void>::promise_type : public TaskPromiseBase {
+	public:
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		void return_void() {}
+	};
+
+	// Starts given Task from a Job, without waiting for it. The Task is first resumed as a Job of its own, and destroyed once it has returned.
+	// If is_sub_job == true, the current dependency graph node is not completed before the Task is.
+	void spawn_task(const JobSpawner& job_spawner, Task<void>&& task, bool is_sub_job);
+
+	// Awaitable returning the TaskContext of the calling Task, e.g. for spawning Jobs or calling parallel_for() from a Task.
+	auto get_task_context();
+
+	// Awaitable that runs all given Tasks in parallel, and resumes the awaiting Task once every one of them is done. The Tasks are spawned
+	// as Jobs, except the last one, which is run by the awaiting worker directly. The results are read with Task::get_result() afterwards.
+	template<typename... Results>
+	auto when_all(Task<Results>&... tasks);
+	template<typename Result>
+	auto when_all(std::span<Task<Result>> tasks);
+
+	// Used internally by Task. Params of the Job resuming a Task.
+	struct TaskResumeParams {
+		std::coroutine_handle<> handle;
+		TaskPromiseBase* promise;
+	};
+
+	// Used internally by Task. Function of the Job resuming a Task.
+	void resume_task(const void* param_buffer, const JobSpawner& job_spawner, WorkerInfo& worker_info);
+
+	// Used internally by Task::operator co_await() and when_all(). Tasks is a range of pointers to TaskBase, or of Tasks.
+	template<typename Tasks>
+	class WhenAllAwaiter {
+	public:
+		WhenAllAwaiter(Tasks tasks) : tasks(tasks) {}
+		bool await_ready() const noexcept { return std::size(tasks) == 0; }
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting) noexcept;
+		void await_resume() const noexcept {}
+
+	private:
+		static TaskBase& get_task(TaskBase* task) { return *task; }
+		static TaskBase& get_task(TaskBase& task) { return task; }
+
+		Tasks tasks;
+		std::atomic<uint32_t> remaining = 0;
+	};
+
+	template<typename Tasks>
+	template<typename Promise>
+	inline std::coroutine_handle<> WhenAllAwaiter<Tasks>::await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+		TaskPromiseBase& awaiting_promise = awaiting.promise();
+		const JobSpawner& job_spawner = *awaiting_promise.job_spawner;
+		// Set before spawning anything, since the spawned Tasks may be completed right away. They can't resume the awaiting Task before
+		// the last one, which is only started after returning from here.
+		remaining.store(static_cast<uint32_t>(std::size(tasks)), std::memory_order::relaxed);
+		TaskBase* last_task = nullptr;
+		for (auto& element : tasks) {
+			TaskBase& task = get_task(element);
+			assert(task.handle && !task.handle.done());
+			task.promise->continuation = awaiting;
+			task.promise->continuation_promise = &awaiting_promise;
+			task.promise->remaining = &remaining;
+			if (last_task) {
+				job_spawner.spawn(resume_task, TaskResumeParams{ last_task->handle, last_task->promise }, job_spawner.has_node());
+			}
+			last_task = &task;
+		}
+		last_task->promise->job_spawner = awaiting_promise.job_spawner;
+		last_task->promise->worker_info = awaiting_promise.worker_info;
+		return last_task->handle;
+	}
+
+	inline auto TaskPromiseBase::final_suspend() noexcept {
+		struct FinalAwaiter {
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> finished) noexcept {
+				TaskPromiseBase& promise = *this->promise;
+				if (!promise.continuation) {
+					// Started with spawn_task(), so nothing owns the frame.
+					finished.destroy();
+					return std::noop_coroutine();
+				}
+				// Read before decrementing, since the awaiting Task may destroy this one as soon as it's resumed by another worker.
+				const std::coroutine_handle<> continuation = promise.continuation;
+				TaskPromiseBase& continuation_promise = *promise.continuation_promise;
+				const JobSpawner* job_spawner = promise.job_spawner;
+				WorkerInfo* worker_info = promise.worker_info;
+				if (promise.remaining->fetch_sub(1, std::memory_order::acq_rel) != 1) {
+					return std::noop_coroutine();
+				}
+				// The last awaited Task to be completed resumes the awaiting one, on the same worker.
+				continuation_promise.job_spawner = job_spawner;
+				continuation_promise.worker_info = worker_info;
+				return continuation;
+			}
+			void await_resume() const noexcept {}
+
+			TaskPromiseBase* promise;
+		};
+		return FinalAwaiter{ this };
+	}
+
+	struct TaskContextAwaiter {
+		bool await_ready() const noexcept { return false; }
+		template<typename Promise>
+		bool await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+			promise = &awaiting.promise();
+			return false;
+		}
+		TaskContext await_resume() const noexcept { return { *promise->job_spawner, *promise->worker_info }; }
+
+		TaskPromiseBase* promise = nullptr;
+	};
+
+	inline auto get_task_context() {
+		return TaskContextAwaiter();
+	}
+
+	template<typename T>
+	inline std::add_lvalue_reference_t<T> Task<T>::get_result() {
+		assert(is_done());
+		auto& result = static_cast<promise_type*>(promise)->result;
+		assert(result);
+		return *result;
+	}
+
+	template<>
+	inline void Task<void>::get_result() {
+		assert(is_done());
+	}
+
+	template<typename T>
+	inline auto Task<T>::operator co_await() && {
+		struct Awaiter : WhenAllAwaiter<std::array<TaskBase*, 1>> {
+			T await_resume() { return std::move(task.get_result()); }
+
+			Task& task;
+		};
+		return Awaiter{ { { this } }, *this };
+	}
+
+	template<>
+	inline auto Task<void>::operator co_await() && {
+		return WhenAllAwaiter<std::array<TaskBase*, 1>>({ this });
+	}
+
+	template<typename T>
+	inline auto Task<T>::operator co_await() & {
+		return std::move(*this).operator co_await();
+	}
+
+	template<typename... Results>
+	inline auto when_all(Task<Results>&... tasks) {
+		return WhenAllAwaiter<std::array<TaskBase*, sizeof...(Results)>>({ &tasks... });
+	}
+
+	template<typename Result>
+	inline auto when_all(std::span<Task<Result>> tasks) {
+		return WhenAllAwaiter<std::span<Task<Result>>>(tasks);
+	}
+
+}
\ No newline at end of file
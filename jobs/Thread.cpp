@@ -0,0 +1,94 @@
+#include "Thread.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace jobs {
+
+#if defined(_WIN32)
+
+	bool set_current_thread_affinity(const std::vector<uint32_t>& processors) {
+		if (processors.empty()) {
+			return true;
+		}
+		// Processor numbers are unique across processor groups: group * 64 + bit, like in ProcessorTopology.
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = static_cast<WORD>(processors.front() / 64);
+		for (const uint32_t processor : processors) {
+			if (processor / 64 == affinity.Group) {
+				affinity.Mask |= KAFFINITY(1) << (processor % 64);
+			}
+		}
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+	}
+
+	bool set_current_thread_priority(ThreadPriority priority) {
+		static constexpr int priorities[] = {
+			THREAD_PRIORITY_LOWEST,
+			THREAD_PRIORITY_BELOW_NORMAL,
+			THREAD_PRIORITY_NORMAL,
+			THREAD_PRIORITY_ABOVE_NORMAL,
+			THREAD_PRIORITY_HIGHEST
+		};
+		return SetThreadPriority(GetCurrentThread(), priorities[static_cast<int>(priority)]) != 0;
+	}
+
+	void set_current_thread_name(const std::string& name) {
+		const int length = MultiByteToWideChar(CP_UTF8, 0, name.c_str(), -1, nullptr, 0);
+		if (length <= 0) {
+			return;
+		}
+		std::wstring wide_name(length, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, name.c_str(), -1, wide_name.data(), length);
+		SetThreadDescription(GetCurrentThread(), wide_name.c_str());
+	}
+
+#elif defined(__linux__)
+
+	bool set_current_thread_affinity(const std::vector<uint32_t>& processors) {
+		if (processors.empty()) {
+			return true;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (const uint32_t processor : processors) {
+			if (processor < CPU_SETSIZE) {
+				CPU_SET(processor, &set);
+			}
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	}
+
+	bool set_current_thread_priority(ThreadPriority priority) {
+		// Normal threads have no priority of their own on Linux, but the nice value applies per thread when given the thread id.
+		static constexpr int nice_values[] = { 10, 5, 0, -5, -10 };
+		return setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), nice_values[static_cast<int>(priority)]) == 0;
+	}
+
+	void set_current_thread_name(const std::string& name) {
+		pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+	}
+
+#else
+
+	bool set_current_thread_affinity(const std::vector<uint32_t>& processors) {
+		return processors.empty();
+	}
+
+	bool set_current_thread_priority(ThreadPriority priority) {
+		return priority == ThreadPriority::Normal;
+	}
+
+	void set_current_thread_name(const std::string&) {}
+
+#endif
+
+}
\ No newline at end of file
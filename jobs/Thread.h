@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace jobs {
+
+	enum class ThreadPriority {
+		Lowest,
+		BelowNormal,
+		Normal,
+		AboveNormal,
+		Highest
+	};
+
+	// Restricts the calling thread to given logical processors (ids as in ProcessorTopology). Returns false if the OS refused.
+	// On Windows, a thread can only have affinity within one processor group, so processors outside the group of the first one are ignored.
+	bool set_current_thread_affinity(const std::vector<uint32_t>& processors);
+	// Returns false if the OS refused, e.g. when raising the priority requires privileges the process does not have.
+	bool set_current_thread_priority(ThreadPriority priority);
+	// Shown in debuggers and profilers. Truncated to 15 characters on Linux.
+	void set_current_thread_name(const std::string& name);
+
+	// Hints the processor that the thread is spinning, which saves power and leaves more resources to the other thread on the same core.
+	inline void cpu_pause() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		asm volatile("yield");
+#endif
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "Topology.h"
+
+#include <thread>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <string>
+#endif
+
+namespace jobs {
+
+	namespace {
+
+		ProcessorTopology detect_fallback() {
+			ProcessorTopology topology;
+			const uint32_t processor_amount = std::max(std::thread::hardware_concurrency(), 1u);
+			for (uint32_t i = 0; i != processor_amount; i++) {
+				topology.processors.push_back({ i, i, 0, 0 });
+			}
+			return topology;
+		}
+
+#if defined(_WIN32)
+
+		// Processor numbers are unique across processor groups: group * 64 + bit.
+		template<typename Function>
+		void for_each_processor(const GROUP_AFFINITY& affinity, Function function) {
+			for (uint32_t bit = 0; bit != sizeof(KAFFINITY) * 8; bit++) {
+				if (affinity.Mask & (KAFFINITY(1) << bit)) {
+					function(static_cast<uint32_t>(affinity.Group) * 64 + bit);
+				}
+			}
+		}
+
+		ProcessorTopology detect_os() {
+			DWORD length = 0;
+			GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+			if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+				return {};
+			}
+			std::vector<uint8_t> buffer(length);
+			if (!GetLogicalProcessorInformationEx(RelationAll, reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data()), &length)) {
+				return {};
+			}
+
+			ProcessorTopology topology;
+			uint32_t core_amount = 0;
+			uint32_t l3_cache_amount = 0;
+			const auto find_processor = [&topology](uint32_t id) -> ProcessorTopology::Processor& {
+				for (ProcessorTopology::Processor& processor : topology.processors) {
+					if (processor.id == id) {
+						return processor;
+					}
+				}
+				topology.processors.push_back({ id, 0, 0, 0 });
+				return topology.processors.back();
+			};
+			// Cores come first in the buffer, so every processor is found by the time caches and NUMA nodes are processed.
+			for (DWORD offset = 0; offset < length;) {
+				const auto* info = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+				if (info->Relationship == RelationProcessorCore) {
+					const uint32_t core = core_amount++;
+					for (WORD i = 0; i != info->Processor.GroupCount; i++) {
+						for_each_processor(info->Processor.GroupMask[i], [&](uint32_t id) { find_processor(id).core = core; });
+					}
+				}
+				else if (info->Relationship == RelationCache && info->Cache.Level == 3) {
+					const uint32_t l3_cache = l3_cache_amount++;
+					for_each_processor(info->Cache.GroupMask, [&](uint32_t id) { find_processor(id).l3_cache = l3_cache; });
+				}
+				else if (info->Relationship == RelationNumaNode) {
+					const uint32_t numa_node = info->NumaNode.NodeNumber;
+					for_each_processor(info->NumaNode.GroupMask, [&](uint32_t id) { find_processor(id).numa_node = numa_node; });
+				}
+				offset += info->Size;
+			}
+			std::sort(topology.processors.begin(), topology.processors.end(), [](const auto& a, const auto& b) { return a.id < b.id; });
+			return topology;
+		}
+
+#elif defined(__linux__)
+
+		// Parses lists in the format used by sysfs, e.g. "0-3,8,10-11".
+		std::vector<uint32_t> read_processor_list(const std::string& path) {
+			std::vector<uint32_t> list;
+			std::ifstream file(path);
+			std::string text;
+			if (!std::getline(file, text)) {
+				return list;
+			}
+			size_t position = 0;
+			while (position < text.size()) {
+				size_t end = text.find(',', position);
+				if (end == std::string::npos) {
+					end = text.size();
+				}
+				const std::string range = text.substr(position, end - position);
+				const size_t dash = range.find('-');
+				try {
+					const uint32_t first = static_cast<uint32_t>(std::stoul(range.substr(0, dash)));
+					const uint32_t last = dash == std::string::npos ? first : static_cast<uint32_t>(std::stoul(range.substr(dash + 1)));
+					for (uint32_t id = first; id <= last; id++) {
+						list.push_back(id);
+					}
+				}
+				catch (const std::exception&) {
+					return {};
+				}
+				position = end + 1;
+			}
+			return list;
+		}
+
+		uint32_t read_number(const std::string& path, uint32_t fallback) {
+			std::ifstream file(path);
+			uint32_t number;
+			return file >> number ? number : fallback;
+		}
+
+		ProcessorTopology detect_os() {
+			const std::string cpu_path = "/sys/devices/system/cpu/";
+			ProcessorTopology topology;
+			for (const uint32_t id : read_processor_list(cpu_path + "online")) {
+				const std::string path = cpu_path + "cpu" + std::to_string(id) + "/";
+				ProcessorTopology::Processor processor{ id, id, 0, 0 };
+				// Identify shared resources by the lowest-numbered processor sharing them.
+				const std::vector<uint32_t> siblings = read_processor_list(path + "topology/thread_siblings_list");
+				if (!siblings.empty()) {
+					processor.core = siblings.front();
+				}
+				// Without an L3 cache, fall back to the processor package.
+				const std::vector<uint32_t> package = read_processor_list(path + "topology/core_siblings_list");
+				if (!package.empty()) {
+					processor.l3_cache = package.front();
+				}
+				for (uint32_t index = 0; ; index++) {
+					const std::string cache_path = path + "cache/index" + std::to_string(index) + "/";
+					const uint32_t level = read_number(cache_path + "level", 0);
+					if (level == 0) {
+						break;
+					}
+					const std::vector<uint32_t> sharing = read_processor_list(cache_path + "shared_cpu_list");
+					if (level == 3 && !sharing.empty()) {
+						processor.l3_cache = sharing.front();
+					}
+				}
+				topology.processors.push_back(processor);
+			}
+			const std::string node_path = "/sys/devices/system/node/";
+			for (const uint32_t node : read_processor_list(node_path + "online")) {
+				const std::vector<uint32_t> node_processors = read_processor_list(node_path + "node" + std::to_string(node) + "/cpulist");
+				for (ProcessorTopology::Processor& processor : topology.processors) {
+					if (std::find(node_processors.begin(), node_processors.end(), processor.id) != node_processors.end()) {
+						processor.numa_node = node;
+					}
+				}
+			}
+			return topology;
+		}
+
+#else
+
+		ProcessorTopology detect_os() {
+			return {};
+		}
+
+#endif
+
+	}
+
+	ProcessorTopology ProcessorTopology::detect() {
+		ProcessorTopology topology = detect_os();
+		if (topology.processors.empty()) {
+			return detect_fallback();
+		}
+		return topology;
+	}
+
+}
\ No newline at end of file
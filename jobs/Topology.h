@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+namespace jobs {
+
+	// Logical processors of the machine, and which of them share a core (SMT siblings), an L3 cache or a NUMA node.
+	struct ProcessorTopology {
+		struct Processor {
+			// Logical processor number as used by the OS.
+			uint32_t id = 0;
+			// Processors with equal values share the given resource.
+			uint32_t core = 0;
+			uint32_t l3_cache = 0;
+			uint32_t numa_node = 0;
+		};
+
+		// Detects the topology of the current machine. Where detection is not supported, or fails, all processors are reported as sharing everything.
+		static ProcessorTopology detect();
+
+		std::vector<Processor> processors;
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "Trace.h"
+
+#include <algorithm>
+
+namespace jobs {
+
+	namespace {
+
+		void write_string(std::ostream& out_stream, const char* text) {
+			out_stream << '"';
+			for (; *text; text++) {
+				if (*text == '"' || *text == '\\') {
+					out_stream << '\\' << *text;
+				}
+				else if (static_cast<unsigned char>(*text) >= 0x20) {
+					out_stream << *text;
+				}
+			}
+			out_stream << '"';
+		}
+
+		void write_event(std::ostream& out_stream, const TraceEvent& event, size_t worker_index, std::chrono::steady_clock::time_point start_time) {
+			const double timestamp = std::chrono::duration<double, std::micro>(event.time - start_time).count();
+			out_stream << ",\n{\"pid\":0,\"tid\":" << worker_index << ",\"ts\":" << timestamp << ",";
+			switch (event.type) {
+			case TraceEventType::JobBegin:
+				out_stream << "\"ph\":\"B\",\"cat\":\"job\",\"name\":";
+				if (event.name) {
+					write_string(out_stream, event.name);
+				}
+				else if (event.id != TraceEvent::invalid_id) {
+					out_stream << "\"node " << event.id << "\"";
+				}
+				else {
+					out_stream << "\"job\"";
+				}
+				out_stream << ",\"args\":{\"function\":\"" << event.function << "\"";
+				if (event.id != TraceEvent::invalid_id) {
+					out_stream << ",\"node\":" << event.id;
+				}
+				out_stream << "}}";
+				break;
+			case TraceEventType::JobEnd:
+			case TraceEventType::Wake:
+				out_stream << "\"ph\":\"E\"}";
+				break;
+			case TraceEventType::Steal:
+				out_stream << "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"steal\",\"name\":\"steal\",\"args\":{\"victim\":" << event.id << "}}";
+				break;
+			case TraceEventType::Park:
+				out_stream << "\"ph\":\"B\",\"cat\":\"idle\",\"name\":\"parked\"}";
+				break;
+			}
+		}
+
+	}
+
+	void write_chrome_trace(std::ostream& out_stream, std::span<const TraceBuffer* const> worker_traces) {
+		// Timestamps are written relative to the oldest recorded event.
+		auto start_time = std::chrono::steady_clock::time_point::max();
+		for (const TraceBuffer* trace : worker_traces) {
+			trace->for_each_event([&start_time](const TraceEvent& event) { start_time = std::min(start_time, event.time); });
+		}
+		// Microsecond timestamps with nanosecond precision.
+		const std::ios_base::fmtflags old_flags = out_stream.flags();
+		const std::streamsize old_precision = out_stream.precision(3);
+		out_stream.setf(std::ios_base::fixed, std::ios_base::floatfield);
+		out_stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+		out_stream << "{\"pid\":0,\"ph\":\"M\",\"name\":\"process_name\",\"args\":{\"name\":\"Scheduler\"}}";
+		for (size_t i = 0; i != worker_traces.size(); i++) {
+			out_stream << ",\n{\"pid\":0,\"tid\":" << i << ",\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":\"Worker " << i << "\"}}";
+			worker_traces[i]->for_each_event([&](const TraceEvent& event) { write_event(out_stream, event, i, start_time); });
+		}
+		out_stream << "\n]}\n";
+		out_stream.flags(old_flags);
+		out_stream.precision(old_precision);
+	}
+
+}
\ No newline at end of file
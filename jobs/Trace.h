@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <limits>
+#include <cstdint>
+#include <cassert>
+
+#include "Config.h"
+
+namespace jobs {
+
+	enum class TraceEventType : uint8_t {
+		JobBegin,
+		JobEnd,
+		// A Job was stolen from another worker.
+		Steal,
+		// The worker blocked while out of work, and was later woken up.
+		Park,
+		Wake
+	};
+
+	// Event recorded by a worker when trace_events is enabled. See Scheduler::write_trace().
+	struct TraceEvent {
+		static constexpr uint32_t invalid_id = std::numeric_limits<uint32_t>::max();
+
+		std::chrono::steady_clock::time_point time;
+		// For Jobs of named nodes, the name of the node (see JobGraphNode::set_name()).
+		const char* name;
+		// For Job events, the function of the Job.
+		const void* function;
+		// For Jobs of graph nodes, the index of the node. For Steal, the worker stolen from.
+		uint32_t id;
+		TraceEventType type;
+	};
+
+	// Ring buffer of the events of a single worker. Only written by the worker itself, so recording an event is a few stores and an increment.
+	// When full, the oldest events are overwritten. Does nothing unless trace_events is enabled.
+	class TraceBuffer {
+	public:
+		using Size = uint64_t;
+
+		// Capacity has to be a power of 2, or 0 when trace_events is disabled.
+		TraceBuffer(Size capacity);
+		TraceBuffer(const TraceBuffer&) = delete;
+		TraceBuffer(TraceBuffer&&) = delete;
+		TraceBuffer& operator=(const TraceBuffer&) = delete;
+		TraceBuffer& operator=(TraceBuffer&&) = delete;
+		void record(TraceEventType type, const char* name = nullptr, const void* function = nullptr, uint32_t id = TraceEvent::invalid_id);
+		void record(std::chrono::steady_clock::time_point time, TraceEventType type, const char* name = nullptr, const void* function = nullptr, uint32_t id = TraceEvent::invalid_id);
+		// Calls function for every event in the buffer, oldest first. Not thread-safe: The worker may not be recording meanwhile.
+		template<typename Function>
+		void for_each_event(Function function) const;
+		void clear() { position = 0; }
+
+	private:
+		const Size capacity;
+		std::unique_ptr<TraceEvent[]> events;
+		Size position = 0;
+	};
+
+	// Writes the events of given workers in the Chrome Trace Event format, which can be opened in chrome://tracing and in Perfetto.
+	void write_chrome_trace(std::ostream& out_stream, std::span<const TraceBuffer* const> worker_traces);
+
+	inline TraceBuffer::TraceBuffer(Size capacity) : capacity(capacity), events(capacity ? new TraceEvent[capacity] : nullptr) {
+		assert((capacity & (capacity - 1)) == 0);
+	}
+
+	inline void TraceBuffer::record(TraceEventType type, const char* name, const void* function, uint32_t id) {
+		if constexpr (trace_events) {
+			record(std::chrono::steady_clock::now(), type, name, function, id);
+		}
+	}
+
+	inline void TraceBuffer::record(std::chrono::steady_clock::time_point time, TraceEventType type, const char* name, const void* function, uint32_t id) {
+		if constexpr (trace_events) {
+			events[position++ & (capacity - 1)] = { time, name, function, id, type };
+		}
+	}
+
+	template<typename Function>
+	inline void TraceBuffer::for_each_event(Function function) const {
+		for (Size i = position > capacity ? position - capacity : 0; i != position; i++) {
+			function(events[i & (capacity - 1)]);
+		}
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <random>
+#include <vector>
+#include <cassert>
+
+namespace jobs {
+
+	// How a worker chooses which other worker to steal from.
+	enum class VictimPolicy {
+		// Uniformly at random among all other workers.
+		Random,
+		// At random among the nearest workers first: ones on the same core (SMT siblings), then ones sharing an L3 cache, then ones on the same
+		// NUMA node, then the rest. Moves on to farther workers after as many failed attempts as there are workers in the current tier.
+		Topology
+	};
+
+	// Picks steal victims for a single worker.
+	class VictimSelector {
+	public:
+		using Size = uint32_t;
+
+		// Tiers of victim worker indices, nearest first. Empty tiers are not allowed. A single tier containing all other workers gives VictimPolicy::Random.
+		VictimSelector(Size seed, std::vector<std::vector<Size>> tiers) : random_generator(seed), tiers(std::move(tiers)) { assert(!this->tiers.empty()); }
+		// Replaces the tiers, e.g. when the set of workers changes, and starts over from the nearest one.
+		void set_tiers(std::vector<std::vector<Size>> tiers);
+		Size select();
+		void steal_succeeded();
+		void steal_failed();
+
+	private:
+		std::minstd_rand random_generator;
+		std::vector<std::vector<Size>> tiers;
+		Size tier_index = 0;
+		Size failed_amount = 0;
+	};
+
+	inline void VictimSelector::set_tiers(std::vector<std::vector<Size>> tiers) {
+		assert(!tiers.empty());
+		this->tiers = std::move(tiers);
+		tier_index = 0;
+		failed_amount = 0;
+	}
+
+	inline VictimSelector::Size VictimSelector::select() {
+		const std::vector<Size>& tier = tiers[tier_index];
+		assert(!tier.empty());
+		return tier[std::uniform_int_distribution<size_t>(0, tier.size() - 1)(random_generator)];
+	}
+
+	inline void VictimSelector::steal_succeeded() {
+		tier_index = 0;
+		failed_amount = 0;
+	}
+
+	inline void VictimSelector::steal_failed() {
+		if (++failed_amount >= tiers[tier_index].size()) {
+			failed_amount = 0;
+			tier_index = (tier_index + 1) % tiers.size();
+		}
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "Worker.h"
+
+#include <cassert>
+
+#include "Job.h"
+#include "SharedJobQueue.h"
+
+namespace jobs {
+
+	void Worker::push_overflow(Job* job) {
+		statistics.add_queue_overflow();
+		if constexpr (queue_overflow_policy == QueueOverflowPolicy::WorkerList) {
+			overflow_jobs.push_back(job);
+			return;
+		}
+		else if constexpr (queue_overflow_policy == QueueOverflowPolicy::SharedQueue) {
+			assert(shared_queue);
+			if (shared_queue->push(job)) {
+				return;
+			}
+		}
+		// QueueOverflowPolicy::RunInline, or the shared queue is full as well.
+		job->run(*this);
+		statistics.add_own_job();
+	}
+
+	bool Worker::refill_queue() {
+		bool refilled = false;
+		while (!overflow_jobs.empty() && job_queue.push(overflow_jobs.back())) {
+			overflow_jobs.pop_back();
+			refilled = true;
+		}
+		return refilled;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vector>
+
+#include "Config.h"
+#include "JobAllocator.h"
+#include "JobQueue.h"
+#include "SharedJobQueue.h"
+#include "ParkingLot.h"
+#include "PerfCounters.h"
+#include "ScratchAllocator.h"
+#include "Statistics.h"
+#include "Trace.h"
+#include "VictimSelector.h"
+
+namespace jobs {
+
+	struct Job;
+	class JobGraphNodeRun;
+
+	// Thread-local state of a single worker. Owned by Scheduler, and passed to Jobs and JobSpawners run by the worker.
+	struct Worker {
+		using Size = uint32_t;
+
+		Worker(Size index, JobChunkAllocator& chunk_allocator, SharedJobQueue* shared_queue, ParkingLot* parking_lot, std::vector<std::vector<Size>> victim_tiers, uint32_t trace_capacity)
+			: job_allocator(chunk_allocator)
+			, scratch_allocator(scratch_block_size)
+			, priority_lane(priority_lane_capacity)
+			, placed_jobs(frame_coherent_placement ? placement_queue_capacity : 2)
+			, shared_queue(shared_queue)
+			, parking_lot(parking_lot)
+			, victim_selector(0xbabe + index, std::move(victim_tiers))
+			, statistics(index)
+			, trace(trace_capacity) {
+			statistics.set_available_perf_counters(perf_counters.get_available_mask());
+		}
+		Worker(const Worker&) = delete;
+		Worker(Worker&&) = delete;
+		Worker& operator=(const Worker&) = delete;
+		Worker& operator=(Worker&&) = delete;
+		// Pushes to job_queue. If it's full, handles the Job according to queue_overflow_policy.
+		void push(Job* job);
+		// Pushes to priority_lane, or to job_queue if the lane is full (or critical_path_priority is disabled).
+		void push_priority(Job* job);
+		// Pops from priority_lane, then from job_queue, then from placed_jobs.
+		Job* pop();
+		// Called by another worker to steal from priority_lane, or a batch from job_queue into the thief's own queue, or from placed_jobs.
+		Job* steal(Worker& thief);
+		// Pushes an array of Jobs to job_queue at once, handling the ones that don't fit according to queue_overflow_policy.
+		void push(Job* jobs, uint32_t amount);
+		// Moves Jobs from overflow_jobs back to job_queue, as many as fit. Returns true if any were moved.
+		bool refill_queue();
+		// True if other workers could steal something from this one.
+		bool has_stealable_jobs() const;
+
+		JobAllocator job_allocator;
+		// Used by JobSpawner::allocate_scratch(). Reset together with job_allocator.
+		ScratchAllocator scratch_allocator;
+		JobQueue job_queue;
+		// Root Jobs of nodes on the critical path, used with critical_path_priority.
+		SharedJobQueue priority_lane;
+		// Jobs placed on this worker by other workers, used with frame_coherent_placement. Taken last by both the worker and thieves, so that
+		// a worker busy with its own queue does not hold them back.
+		SharedJobQueue placed_jobs;
+		// Jobs that did not fit into job_queue, used by QueueOverflowPolicy::WorkerList.
+		std::vector<Job*> overflow_jobs;
+		// Nodes waiting to be skipped by JobGraphNodeRun::skip(), while is_skipping_nodes is set.
+		std::vector<JobGraphNodeRun*> skipped_nodes;
+		bool is_skipping_nodes = false;
+		// Shared by all workers, used by QueueOverflowPolicy::SharedQueue. Null with other policies.
+		SharedJobQueue* shared_queue;
+		// Shared by all workers, used by IdlePolicy::SpinThenPark. Null with other policies.
+		ParkingLot* parking_lot;
+		VictimSelector victim_selector;
+		// Used with perf_counters. Counts the thread the Worker is created on, so it has to be created on its own thread.
+		PerfCounters perf_counters;
+		WorkerStatistics statistics;
+		// Used with trace_events.
+		TraceBuffer trace;
+
+	private:
+		void push_overflow(Job* job);
+		// Wakes up a parked worker to steal newly pushed Jobs.
+		void notify_jobs_available();
+	};
+
+	inline void Worker::push(Job* job) {
+		if (!job_queue.push(job)) {
+			push_overflow(job);
+		}
+		notify_jobs_available();
+	}
+
+	inline void Worker::push_priority(Job* job) {
+		if constexpr (critical_path_priority) {
+			if (priority_lane.push(job)) {
+				notify_jobs_available();
+				return;
+			}
+		}
+		push(job);
+	}
+
+	inline Job* Worker::pop() {
+		if constexpr (critical_path_priority) {
+			if (Job* job = priority_lane.pop()) {
+				return job;
+			}
+		}
+		if constexpr (frame_coherent_placement) {
+			if (Job* job = job_queue.pop()) {
+				return job;
+			}
+			return placed_jobs.pop();
+		}
+		return job_queue.pop();
+	}
+
+	inline Job* Worker::steal(Worker& thief) {
+		if constexpr (critical_path_priority) {
+			if (Job* job = priority_lane.pop()) {
+				return job;
+			}
+		}
+		Job* job = job_queue.steal_batch(thief.job_queue);
+		// The rest of the batch can be stolen from the thief in turn, so pass the wakeup on.
+		if (job && !thief.job_queue.is_empty()) {
+			thief.notify_jobs_available();
+		}
+		if constexpr (frame_coherent_placement) {
+			if (!job) {
+				job = placed_jobs.pop();
+			}
+		}
+		return job;
+	}
+
+	inline void Worker::push(Job* jobs, uint32_t amount) {
+		for (uint32_t i = job_queue.push(jobs, static_cast<JobQueue::Size>(amount)); i != amount; i++) {
+			push_overflow(jobs + i);
+		}
+		notify_jobs_available();
+	}
+
+	inline bool Worker::has_stealable_jobs() const {
+		if constexpr (critical_path_priority) {
+			if (!priority_lane.is_empty()) {
+				return true;
+			}
+		}
+		if constexpr (frame_coherent_placement) {
+			if (!placed_jobs.is_empty()) {
+				return true;
+			}
+		}
+		return !job_queue.is_empty();
+	}
+
+	inline void Worker::notify_jobs_available() {
+		if constexpr (idle_policy == IdlePolicy::SpinThenPark) {
+			parking_lot->unpark_one(statistics.info.get_worker_index());
+		}
+	}
+
+}
\ No newline at end of file